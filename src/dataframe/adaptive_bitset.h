@@ -0,0 +1,379 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <boost/dynamic_bitset.hpp>
+
+namespace frame {
+
+// Bit-array split into chunks of 2^16 bits, each stored in the cheapest of
+// three containers (as in Roaring bitmaps):
+//   array  - sorted 16-bit offsets, while the chunk holds <= 4096 bits
+//   bitmap - 1024 words, for dense chunks
+//   run    - [start, end) intervals, for full chunks or after run_optimize()
+// Chunks without bits take no container at all, so a sparse n-bit array
+// costs far less than n / 8 bytes. Exposes the subset of the
+// boost::dynamic_bitset interface used by the IEJoin sweeps.
+class AdaptiveBitset {
+public:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+  static constexpr uint32_t kChunkBits = 1u << 16;
+  static constexpr uint32_t kMaxArray = 4096;
+  static constexpr uint32_t kWords = kChunkBits / 64;
+
+  explicit AdaptiveBitset(size_t n = 0)
+      : num_bits(n), chunks((n + kChunkBits - 1) / kChunkBits),
+        nonempty(chunks.size()) {}
+
+  [[nodiscard]] size_t size() const { return num_bits; }
+
+  [[nodiscard]] size_t count() const {
+    size_t result = 0;
+    for (const auto &chunk : chunks) {
+      result += chunk.cardinality;
+    }
+    return result;
+  }
+
+  [[nodiscard]] bool test(size_t p) const {
+    const Chunk &chunk = chunks[p >> 16];
+    uint16_t low = p & 0xFFFF;
+    switch (chunk.kind) {
+    case kArray:
+      return std::binary_search(chunk.array.begin(), chunk.array.end(), low);
+    case kBitmap:
+      return (chunk.bitmap[low >> 6] >> (low & 63)) & 1;
+    case kRun:
+      return find_run(chunk, low) != chunk.runs.end();
+    default:
+      return false;
+    }
+  }
+
+  AdaptiveBitset &set(size_t p, bool value = true) {
+    if (!value) {
+      return reset(p);
+    }
+    size_t c = p >> 16;
+    Chunk &chunk = chunks[c];
+    uint16_t low = p & 0xFFFF;
+    switch (chunk.kind) {
+    case kEmpty:
+      chunk.kind = kArray;
+      chunk.array.push_back(low);
+      chunk.cardinality = 1;
+      nonempty.set(c);
+      break;
+    case kArray: {
+      auto item = std::lower_bound(chunk.array.begin(), chunk.array.end(), low);
+      if (item != chunk.array.end() && *item == low) {
+        break;
+      }
+      chunk.array.insert(item, low);
+      if (++chunk.cardinality > kMaxArray) {
+        to_bitmap(chunk);
+      }
+      break;
+    }
+    case kBitmap: {
+      uint64_t &word = chunk.bitmap[low >> 6];
+      uint64_t bit = uint64_t(1) << (low & 63);
+      if (!(word & bit)) {
+        word |= bit;
+        if (++chunk.cardinality == capacity(c)) {
+          to_full_run(chunk, capacity(c));
+        }
+      }
+      break;
+    }
+    case kRun:
+      set_in_runs(chunk, low);
+      break;
+    }
+    return *this;
+  }
+
+  // set every bit
+  AdaptiveBitset &set() {
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      to_full_run(chunks[c], capacity(c));
+      nonempty.set(c);
+    }
+    return *this;
+  }
+
+  AdaptiveBitset &reset(size_t p) {
+    size_t c = p >> 16;
+    Chunk &chunk = chunks[c];
+    uint16_t low = p & 0xFFFF;
+    switch (chunk.kind) {
+    case kArray: {
+      auto item = std::lower_bound(chunk.array.begin(), chunk.array.end(), low);
+      if (item != chunk.array.end() && *item == low) {
+        chunk.array.erase(item);
+        chunk.cardinality -= 1;
+      }
+      break;
+    }
+    case kBitmap: {
+      uint64_t &word = chunk.bitmap[low >> 6];
+      uint64_t bit = uint64_t(1) << (low & 63);
+      if (word & bit) {
+        word &= ~bit;
+        if (--chunk.cardinality <= kMaxArray) {
+          to_array(chunk);
+        }
+      }
+      break;
+    }
+    case kRun:
+      reset_in_runs(chunk, low);
+      break;
+    default:
+      break;
+    }
+    if (chunk.kind != kEmpty && chunk.cardinality == 0) {
+      chunk = Chunk();
+      nonempty.reset(c);
+    }
+    return *this;
+  }
+
+  [[nodiscard]] size_t find_first() const { return find_from(0); }
+
+  // first set bit after p, npos if none (same contract as dynamic_bitset)
+  [[nodiscard]] size_t find_next(size_t p) const {
+    if (num_bits == 0 || p >= num_bits - 1) {
+      return npos;
+    }
+    return find_from(p + 1);
+  }
+
+  // convert bitmap chunks to runs wherever the runs take less space
+  void run_optimize() {
+    for (auto &chunk : chunks) {
+      if (chunk.kind != kBitmap) {
+        continue;
+      }
+      std::vector<Run> runs = bitmap_runs(chunk);
+      if (runs.size() * sizeof(Run) < kWords * sizeof(uint64_t)) {
+        chunk.bitmap = std::vector<uint64_t>();
+        chunk.runs = std::move(runs);
+        chunk.kind = kRun;
+      }
+    }
+  }
+
+  // bytes held by the containers and the chunk directory
+  [[nodiscard]] size_t memory_usage() const {
+    size_t bytes = chunks.capacity() * sizeof(Chunk) + nonempty.num_blocks() * 8;
+    for (const auto &chunk : chunks) {
+      bytes += chunk.array.capacity() * sizeof(uint16_t) +
+               chunk.bitmap.capacity() * sizeof(uint64_t) +
+               chunk.runs.capacity() * sizeof(Run);
+    }
+    return bytes;
+  }
+
+private:
+  enum Kind : uint8_t { kEmpty, kArray, kBitmap, kRun };
+
+  // [start, end) offsets inside a chunk
+  struct Run {
+    uint32_t start;
+    uint32_t end;
+  };
+
+  struct Chunk {
+    Kind kind = kEmpty;
+    uint32_t cardinality = 0;
+    std::vector<uint16_t> array;
+    std::vector<uint64_t> bitmap;
+    std::vector<Run> runs;
+  };
+
+  [[nodiscard]] uint32_t capacity(size_t c) const {
+    return static_cast<uint32_t>(
+        std::min<size_t>(kChunkBits, num_bits - c * kChunkBits));
+  }
+
+  static std::vector<Run>::const_iterator find_run(const Chunk &chunk,
+                                                   uint32_t low) {
+    // first run ending after low
+    auto item = std::upper_bound(
+        chunk.runs.begin(), chunk.runs.end(), low,
+        [](uint32_t value, const Run &run) { return value < run.end; });
+    if (item != chunk.runs.end() && item->start <= low) {
+      return item;
+    }
+    return chunk.runs.end();
+  }
+
+  static void to_bitmap(Chunk &chunk) {
+    chunk.bitmap.assign(kWords, 0);
+    if (chunk.kind == kArray) {
+      for (uint16_t low : chunk.array) {
+        chunk.bitmap[low >> 6] |= uint64_t(1) << (low & 63);
+      }
+      chunk.array = std::vector<uint16_t>();
+    } else {
+      for (const auto &run : chunk.runs) {
+        for (uint32_t low = run.start; low < run.end; ++low) {
+          chunk.bitmap[low >> 6] |= uint64_t(1) << (low & 63);
+        }
+      }
+      chunk.runs = std::vector<Run>();
+    }
+    chunk.kind = kBitmap;
+  }
+
+  static void to_array(Chunk &chunk) {
+    chunk.array.clear();
+    chunk.array.reserve(chunk.cardinality);
+    for (uint32_t w = 0; w < kWords; ++w) {
+      for (uint64_t word = chunk.bitmap[w]; word != 0; word &= word - 1) {
+        chunk.array.push_back(w * 64 + __builtin_ctzll(word));
+      }
+    }
+    chunk.bitmap = std::vector<uint64_t>();
+    chunk.kind = kArray;
+  }
+
+  static void to_full_run(Chunk &chunk, uint32_t bits) {
+    chunk = Chunk();
+    chunk.kind = kRun;
+    chunk.cardinality = bits;
+    chunk.runs.push_back(Run{0, bits});
+  }
+
+  static std::vector<Run> bitmap_runs(const Chunk &chunk) {
+    std::vector<Run> runs;
+    for (uint32_t low = 0; low < kChunkBits; ++low) {
+      if ((chunk.bitmap[low >> 6] >> (low & 63)) & 1) {
+        if (!runs.empty() && runs.back().end == low) {
+          runs.back().end += 1;
+        } else {
+          runs.push_back(Run{low, low + 1});
+        }
+      } else if (chunk.bitmap[low >> 6] >> (low & 63) == 0) {
+        low |= 63; // rest of the word is empty
+      }
+    }
+    return runs;
+  }
+
+  static void set_in_runs(Chunk &chunk, uint32_t low) {
+    auto &runs = chunk.runs;
+    // first run ending at or after low: it contains low or can grow onto it
+    auto item = std::lower_bound(
+        runs.begin(), runs.end(), low,
+        [](const Run &run, uint32_t value) { return run.end < value; });
+    if (item != runs.end() && item->start <= low && low < item->end) {
+      return;
+    }
+    chunk.cardinality += 1;
+    if (item != runs.end() && item->end == low) {
+      item->end += 1;
+      auto next = item + 1;
+      if (next != runs.end() && next->start == item->end) {
+        item->end = next->end;
+        runs.erase(next);
+      }
+    } else if (item != runs.end() && item->start == low + 1) {
+      item->start = low;
+    } else {
+      runs.insert(item, Run{low, low + 1});
+    }
+    if (runs.size() * sizeof(Run) > kWords * sizeof(uint64_t)) {
+      to_bitmap(chunk);
+    }
+  }
+
+  static void reset_in_runs(Chunk &chunk, uint32_t low) {
+    auto &runs = chunk.runs;
+    auto item = std::upper_bound(
+        runs.begin(), runs.end(), low,
+        [](uint32_t value, const Run &run) { return value < run.end; });
+    if (item == runs.end() || low < item->start) {
+      return;
+    }
+    chunk.cardinality -= 1;
+    if (item->start == low) {
+      item->start += 1;
+      if (item->start == item->end) {
+        runs.erase(item);
+      }
+    } else if (item->end == low + 1) {
+      item->end = low;
+    } else {
+      Run tail{low + 1, item->end};
+      item->end = low;
+      runs.insert(item + 1, tail);
+    }
+    if (runs.size() * sizeof(Run) > kWords * sizeof(uint64_t)) {
+      to_bitmap(chunk);
+    }
+  }
+
+  // first set offset >= low inside the chunk, kChunkBits if none
+  static uint32_t find_in_chunk(const Chunk &chunk, uint32_t low) {
+    switch (chunk.kind) {
+    case kArray: {
+      auto item = std::lower_bound(chunk.array.begin(), chunk.array.end(), low);
+      return item == chunk.array.end() ? kChunkBits : *item;
+    }
+    case kBitmap: {
+      uint32_t w = low >> 6;
+      uint64_t word = chunk.bitmap[w] & (~uint64_t(0) << (low & 63));
+      while (word == 0) {
+        if (++w == kWords) {
+          return kChunkBits;
+        }
+        word = chunk.bitmap[w];
+      }
+      return w * 64 + __builtin_ctzll(word);
+    }
+    case kRun: {
+      auto item = std::upper_bound(
+          chunk.runs.begin(), chunk.runs.end(), low,
+          [](uint32_t value, const Run &run) { return value < run.end; });
+      if (item == chunk.runs.end()) {
+        return kChunkBits;
+      }
+      return std::max(item->start, low);
+    }
+    default:
+      return kChunkBits;
+    }
+  }
+
+  [[nodiscard]] size_t find_from(size_t p) const {
+    if (p >= num_bits) {
+      return npos;
+    }
+    size_t c = p >> 16;
+    uint32_t low = p & 0xFFFF;
+    if (!nonempty.test(c)) {
+      c = nonempty.find_next(c);
+      low = 0;
+    }
+    while (c != boost::dynamic_bitset<>::npos) {
+      uint32_t found = find_in_chunk(chunks[c], low);
+      if (found < kChunkBits) {
+        return c * kChunkBits + found;
+      }
+      c = nonempty.find_next(c);
+      low = 0;
+    }
+    return npos;
+  }
+
+  size_t num_bits;
+  std::vector<Chunk> chunks;
+  // chunks holding at least one bit, to skip empty stretches quickly
+  boost::dynamic_bitset<> nonempty;
+};
+
+} // namespace frame
@@ -0,0 +1,310 @@
+#ifndef ARROW_C_DATA_H
+#define ARROW_C_DATA_H
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "dataframe.h"
+
+// The structs of the Arrow C Data Interface, as the specification gives
+// them: any producer or consumer of the ABI defines them the same way,
+// guarded so that the first definition included wins.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema
+{
+  // Array type description
+  const char *format;
+  const char *name;
+  const char *metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema **children;
+  struct ArrowSchema *dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowSchema *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+struct ArrowArray
+{
+  // Array data description
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void **buffers;
+  struct ArrowArray **children;
+  struct ArrowArray *dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowArray *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+namespace frame
+{
+  // Exchange of columns with other Arrow producers and consumers through the
+  // C Data Interface, without copying values either way. A view exports as
+  // a struct array ("+s") with one child per column; the exported arrays
+  // share the column buffers and keep them alive until released. An
+  // imported array is wrapped by spans whose owner releases it when the
+  // last of them goes. A ValidityBitmap is the Arrow bitmap as 64-bit words,
+  // which needs a little-endian machine.
+  static_assert(std::endian::native == std::endian::little,
+                "validity bitmaps are shared with Arrow as little-endian words");
+
+  // Arrow format string of values of type T
+  template <typename T>
+  constexpr const char *arrow_format()
+  {
+    static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>,
+                  "Arrow columns of plain numbers only");
+    if constexpr (std::is_floating_point_v<T>)
+    {
+      static_assert(sizeof(T) == 4 || sizeof(T) == 8);
+      return sizeof(T) == 4 ? "f" : "g";
+    }
+    else if constexpr (std::is_signed_v<T>)
+    {
+      return sizeof(T) == 1 ? "c" : sizeof(T) == 2 ? "s" : sizeof(T) == 4 ? "i" : "l";
+    }
+    else
+    {
+      return sizeof(T) == 1 ? "C" : sizeof(T) == 2 ? "S" : sizeof(T) == 4 ? "I" : "L";
+    }
+  }
+
+  // private_data of an exported array: what its buffers point into, and
+  // the children it releases with it
+  struct ArrowExportedArray
+  {
+    std::vector<std::shared_ptr<const void>> owners;
+    std::vector<const void *> buffers;
+    std::vector<ArrowArray> children;
+    std::vector<ArrowArray *> child_pointers;
+  };
+
+  // private_data of an exported schema
+  struct ArrowExportedSchema
+  {
+    std::string format;
+    std::string name;
+    std::vector<ArrowSchema> children;
+    std::vector<ArrowSchema *> child_pointers;
+  };
+
+  inline void release_arrow_array(ArrowArray *array)
+  {
+    auto *data = static_cast<ArrowExportedArray *>(array->private_data);
+    // a consumer may have moved a child out, marking it released
+    for (ArrowArray &child : data->children)
+    {
+      if (child.release != nullptr)
+        child.release(&child);
+    }
+    delete data;
+    array->release = nullptr;
+  }
+
+  inline void release_arrow_schema(ArrowSchema *schema)
+  {
+    auto *data = static_cast<ArrowExportedSchema *>(schema->private_data);
+    for (ArrowSchema &child : data->children)
+    {
+      if (child.release != nullptr)
+        child.release(&child);
+    }
+    delete data;
+    schema->release = nullptr;
+  }
+
+  // array and schema of data with the given children, to be filled in
+  inline ArrowExportedArray *arrow_array(ArrowArray *out, int64_t length, size_t n_children)
+  {
+    auto *data = new ArrowExportedArray();
+    data->children.resize(n_children);
+    for (ArrowArray &child : data->children)
+      data->child_pointers.push_back(&child);
+    *out = ArrowArray{};
+    out->length = length;
+    out->n_children = static_cast<int64_t>(n_children);
+    out->children = n_children > 0 ? data->child_pointers.data() : nullptr;
+    out->release = release_arrow_array;
+    out->private_data = data;
+    return data;
+  }
+
+  inline ArrowExportedSchema *arrow_schema(ArrowSchema *out, std::string format, std::string name,
+                                           int64_t flags, size_t n_children)
+  {
+    auto *data = new ArrowExportedSchema{std::move(format), std::move(name), {}, {}};
+    data->children.resize(n_children);
+    for (ArrowSchema &child : data->children)
+      data->child_pointers.push_back(&child);
+    *out = ArrowSchema{};
+    out->format = data->format.c_str();
+    out->name = data->name.c_str();
+    out->flags = flags;
+    out->n_children = static_cast<int64_t>(n_children);
+    out->children = n_children > 0 ? data->child_pointers.data() : nullptr;
+    out->release = release_arrow_schema;
+    out->private_data = data;
+    return data;
+  }
+
+  // Export span as a primitive array named name. The buffers are the
+  // span's values and validity words, kept alive by the array.
+  template <typename T>
+  void export_arrow(const ColumnSpan<T> &span, const std::string &name, ArrowArray *out_array,
+                    ArrowSchema *out_schema)
+  {
+    const Validity &validity = span.get_validity();
+    arrow_schema(out_schema, arrow_format<T>(), name, validity ? ARROW_FLAG_NULLABLE : 0, 0);
+    ArrowExportedArray *data = arrow_array(out_array, static_cast<int64_t>(span.size()), 0);
+    data->owners = {span.get_buffer(), validity};
+    data->buffers = {validity ? validity->data() : nullptr, span.data()};
+    out_array->null_count = validity ? static_cast<int64_t>(validity->null_count()) : 0;
+    out_array->n_buffers = 2;
+    out_array->buffers = data->buffers.data();
+  }
+
+  // Export view as a struct array of its columns
+  template <typename T>
+  void export_arrow(const DataframeView<T> &view, ArrowArray *out_array, ArrowSchema *out_schema)
+  {
+    ArrowExportedSchema *schema = arrow_schema(out_schema, "+s", "", 0, view.num_cols());
+    ArrowExportedArray *data =
+        arrow_array(out_array, static_cast<int64_t>(view.num_rows()), view.num_cols());
+    // a struct array has a validity buffer only, absent: no NULL rows
+    data->buffers = {nullptr};
+    out_array->n_buffers = 1;
+    out_array->buffers = data->buffers.data();
+    for (size_t c = 0; c < view.num_cols(); ++c)
+    {
+      export_arrow(view.get_column(c), view.get_column_str()[c], &data->children[c],
+                   &schema->children[c]);
+    }
+  }
+
+  // Export join result pairs as a struct array of two int32 columns, left
+  // and right. Pairs are stored interleaved, so this is the one export that
+  // copies: into a column buffer per side, which the array then owns.
+  inline void export_arrow(const std::vector<std::pair<int, int>> &pairs, ArrowArray *out_array,
+                           ArrowSchema *out_schema)
+  {
+    ColumnVector<int32_t> left(pairs.size()), right(pairs.size());
+    parallel_for(0, pairs.size(), parallel_grain, [&](size_t lo, size_t hi)
+                 {
+      for (size_t i = lo; i < hi; ++i)
+      {
+        left[i] = pairs[i].first;
+        right[i] = pairs[i].second;
+      } });
+    DataframeView<int32_t> view(pairs.size());
+    view.insert("left", ColumnSpan<int32_t>(std::move(left)));
+    view.insert("right", ColumnSpan<int32_t>(std::move(right)));
+    export_arrow(view, out_array, out_schema);
+  }
+
+  // An imported array, released when the spans over it are gone
+  struct ArrowImportedArray
+  {
+    ArrowArray array;
+
+    explicit ArrowImportedArray(ArrowArray *source) : array(*source)
+    {
+      // moved: the source is marked released
+      source->release = nullptr;
+    }
+
+    ArrowImportedArray(const ArrowImportedArray &) = delete;
+    ArrowImportedArray &operator=(const ArrowImportedArray &) = delete;
+
+    ~ArrowImportedArray()
+    {
+      if (array.release != nullptr)
+        array.release(&array);
+    }
+  };
+
+  // Span over the primitive array, which owner keeps alive. The values are
+  // the array's own buffer; the validity bitmap, if any, is copied into a
+  // ValidityBitmap, which owns its words.
+  template <typename T>
+  ColumnSpan<T> import_arrow_column(const ArrowArray &array, const ArrowSchema &schema,
+                                    std::shared_ptr<const void> owner)
+  {
+    if (std::strcmp(schema.format, arrow_format<T>()) != 0)
+    {
+      throw(std::invalid_argument(std::string("Arrow format '") + schema.format +
+                                  "' is not '" + arrow_format<T>() + "'"));
+    }
+    if (array.n_buffers != 2 || array.length < 0 || array.offset < 0)
+      throw(std::invalid_argument("malformed Arrow primitive array"));
+    size_t length = static_cast<size_t>(array.length);
+    size_t offset = static_cast<size_t>(array.offset);
+    const T *values = static_cast<const T *>(array.buffers[1]);
+    Validity validity;
+    const auto *bits = static_cast<const uint8_t *>(array.buffers[0]);
+    if (array.null_count != 0 && bits != nullptr)
+    {
+      // foreign bitmaps are bytes, possibly not padded to whole words
+      std::vector<uint64_t> words((offset + length + 63) / 64, 0);
+      std::memcpy(words.data(), bits, (offset + length + 7) / 8);
+      ValidityBitmap bitmap(words.data(), offset + length);
+      if (offset > 0)
+        bitmap = bitmap.slice(offset, length);
+      validity = std::make_shared<const ValidityBitmap>(std::move(bitmap));
+    }
+    return ColumnSpan<T>(values == nullptr ? nullptr : values + offset, length,
+                         std::move(owner), std::move(validity));
+  }
+
+  // View over a struct array of primitive columns of type T, as export_arrow
+  // makes. Takes over array, which is released with the last span over it,
+  // and releases schema. The values are not copied.
+  template <typename T>
+  DataframeView<T> import_arrow(ArrowArray *array, ArrowSchema *schema)
+  {
+    auto imported = std::make_shared<const ArrowImportedArray>(array);
+    std::unique_ptr<ArrowSchema, void (*)(ArrowSchema *)> schema_guard(
+        schema, [](ArrowSchema *s)
+        { if (s->release != nullptr) s->release(s); });
+    const ArrowArray &parent = imported->array;
+    if (std::strcmp(schema->format, "+s") != 0 || parent.n_children != schema->n_children)
+      throw(std::invalid_argument("Arrow array is not a struct of columns"));
+    if (parent.null_count != 0)
+      throw(std::invalid_argument("Arrow struct arrays with NULL rows are not supported"));
+    if (parent.offset != 0)
+      throw(std::invalid_argument("Arrow struct arrays with an offset are not supported"));
+
+    DataframeView<T> view(static_cast<size_t>(parent.length));
+    for (int64_t c = 0; c < parent.n_children; ++c)
+    {
+      const ArrowSchema &field = *schema->children[c];
+      view.insert(field.name != nullptr ? field.name : "",
+                  import_arrow_column<T>(*parent.children[c], field, imported));
+    }
+    return view;
+  }
+} // namespace frame
+#endif // ARROW_C_DATA_H
@@ -0,0 +1,133 @@
+#ifndef BATCH_READER_H
+#define BATCH_READER_H
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "columnar_file.h"
+#include "dataframe.h"
+
+namespace frame
+{
+  // Source of the rows of a frame in batches of at most batch_rows rows, for
+  // inputs larger than memory: the reader keeps nothing of the batches it
+  // returned, so the memory in use is that of the batches the caller keeps.
+  template <typename T>
+  class BatchReader
+  {
+  public:
+    explicit BatchReader(size_t batch_rows) : batch_rows(std::max<size_t>(1, batch_rows)) {}
+
+    virtual ~BatchReader() = default;
+
+    // the next rows into batch, false when there are none left
+    virtual bool next(DataframeView<T> &batch) = 0;
+
+    // row of the input at which the last batch starts
+    [[nodiscard]] size_t batch_offset() const { return offset; }
+
+  protected:
+    size_t batch_rows;
+    size_t offset = 0;
+    size_t next_offset = 0;
+  };
+
+  // Batches of a csv file, parsed as Dataframe::read_csv does. The file is
+  // mapped and read once front to back; the pages of the rows already
+  // parsed are dropped, so a file of any size is read in the memory of one
+  // batch.
+  template <typename T>
+  class CsvBatchReader : public BatchReader<T>
+  {
+  public:
+    CsvBatchReader(const std::string &filename, size_t batch_rows,
+                   const CsvOptions &options = {})
+        : BatchReader<T>(batch_rows), file(filename), delimiter(options.delimiter)
+    {
+      std::vector<std::string_view> fields;
+      cursor = split_csv_row(file.begin(), file.end(), delimiter, fields);
+      layout = Dataframe<T>::csv_layout(fields, options, names);
+    }
+
+    [[nodiscard]] const std::vector<std::string> &get_column_str() const { return names; }
+
+    bool next(DataframeView<T> &batch) override
+    {
+      if (names.empty())
+        return false;
+      std::vector<ColumnVector<T>> values;
+      std::vector<ValidityBitmap> validity;
+      size_t rows = 0;
+      // a stretch of rows with the wrong number of fields parses to no
+      // rows: go on to the next batch of the file, or its end
+      while (rows == 0)
+      {
+        if (cursor == file.end())
+          return false;
+        values.assign(names.size(), ColumnVector<T>(this->batch_rows));
+        validity.assign(names.size(), ValidityBitmap());
+        const char *start = cursor;
+        cursor = Dataframe<T>::parse_rows(cursor, file.end(), delimiter, layout, 0, values,
+                                          validity, this->batch_rows);
+        file.advise(start - file.begin(), cursor - start, MADV_DONTNEED);
+        rows = validity[0].size();
+      }
+      this->offset = this->next_offset;
+      this->next_offset += rows;
+      batch = DataframeView<T>(rows);
+      for (size_t i = 0; i < names.size(); ++i)
+      {
+        values[i].resize(rows);
+        Validity bitmap;
+        if (validity[i].null_count() > 0)
+          bitmap = std::make_shared<const ValidityBitmap>(std::move(validity[i]));
+        batch.insert(names[i], ColumnSpan<T>(std::move(values[i]), std::move(bitmap)));
+      }
+      return true;
+    }
+
+  private:
+    MappedFile file;
+    char delimiter;
+    std::vector<std::string> names;
+    typename Dataframe<T>::CsvLayout layout;
+    const char *cursor = nullptr;
+  };
+
+  // Batches of a columnar file: slices of the mapping, nothing is copied.
+  // The next batch is read ahead and the pages of the previous one dropped.
+  template <typename T>
+  class ColumnarBatchReader : public BatchReader<T>
+  {
+  public:
+    ColumnarBatchReader(const std::string &filename, size_t batch_rows)
+        : BatchReader<T>(batch_rows), file(filename) {}
+
+    [[nodiscard]] const std::vector<std::string> &get_column_str() const
+    {
+      return file.get_column_str();
+    }
+
+    bool next(DataframeView<T> &batch) override
+    {
+      size_t first = this->next_offset;
+      if (first >= file.num_rows())
+        return false;
+      size_t rows = std::min(this->batch_rows, file.num_rows() - first);
+      if (first > 0)
+        file.advise_rows(this->offset, first - this->offset, MADV_DONTNEED);
+      file.advise_rows(first, std::min(2 * this->batch_rows, file.num_rows() - first),
+                       MADV_WILLNEED);
+      this->offset = first;
+      this->next_offset = first + rows;
+      batch = file.view().slice(first, rows);
+      return true;
+    }
+
+  private:
+    ColumnarFile<T> file;
+  };
+} // namespace frame
+#endif // BATCH_READER_H
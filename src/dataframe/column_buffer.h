@@ -0,0 +1,330 @@
+#ifndef COLUMN_BUFFER_H
+#define COLUMN_BUFFER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+namespace frame
+{
+  // Process-wide allocator of column buffers. Blocks are 64-byte aligned
+  // for SIMD loads and rounded up to a power of two; freed blocks are kept
+  // in one free list per size, so the columns that the joins and sorts
+  // allocate again and again (same sizes on every call) are recycled instead
+  // of going back to malloc. Blocks from 2 MiB on are mapped with mmap and,
+  // when enabled, advised to use transparent huge pages.
+  class ColumnArena
+  {
+  public:
+    static constexpr size_t kAlignment = 64;
+    static constexpr size_t kMappedBytes = size_t(2) << 20;
+
+    struct Stats
+    {
+      size_t system_allocations = 0; // blocks obtained from the system
+      size_t reused = 0;             // blocks served from a free list
+      size_t cached_bytes = 0;       // bytes held in the free lists
+    };
+
+    static ColumnArena &instance()
+    {
+      // never destroyed: columns of static frames may be freed after main
+      static ColumnArena *arena = create();
+      return *arena;
+    }
+
+    void *allocate(size_t bytes)
+    {
+      size_t size = block_size(bytes);
+      size_t size_class = std::countr_zero(size);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &blocks = free_lists[size_class];
+        if (!blocks.empty())
+        {
+          void *block = blocks.back();
+          blocks.pop_back();
+          stats_.reused++;
+          stats_.cached_bytes -= size;
+          return block;
+        }
+        stats_.system_allocations++;
+      }
+      void *block;
+      if (size >= kMappedBytes)
+      {
+        block = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED)
+          throw std::bad_alloc();
+        if (huge_pages)
+          madvise(block, size, MADV_HUGEPAGE);
+      }
+      else
+      {
+        block = std::aligned_alloc(kAlignment, size);
+        if (block == nullptr)
+          throw std::bad_alloc();
+      }
+      return block;
+    }
+
+    void deallocate(void *block, size_t bytes)
+    {
+      size_t size = block_size(bytes);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stats_.cached_bytes + size <= max_cached_bytes)
+        {
+          free_lists[std::countr_zero(size)].push_back(block);
+          stats_.cached_bytes += size;
+          return;
+        }
+      }
+      release_block(block, size);
+    }
+
+    // advise transparent huge pages for the mapped blocks allocated from now
+    void set_huge_pages(bool enable) { huge_pages = enable; }
+
+    // bytes the free lists may hold before blocks go back to the system
+    void set_max_cached_bytes(size_t bytes)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      max_cached_bytes = bytes;
+    }
+
+    // return every cached block to the system
+    void release()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t c = 0; c < free_lists.size(); ++c)
+      {
+        for (void *block : free_lists[c])
+          release_block(block, size_t(1) << c);
+        free_lists[c].clear();
+      }
+      stats_.cached_bytes = 0;
+    }
+
+    Stats stats()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stats_;
+    }
+
+  private:
+    ColumnArena() = default;
+
+    static ColumnArena *create()
+    {
+      auto *arena = new ColumnArena();
+      // a child forked while another thread allocates must not inherit a
+      // locked mutex
+      pthread_atfork([]
+                     { instance().mutex.lock(); },
+                     []
+                     { instance().mutex.unlock(); },
+                     []
+                     { instance().mutex.unlock(); });
+      return arena;
+    }
+
+    static size_t block_size(size_t bytes)
+    {
+      return std::bit_ceil(std::max(bytes, kAlignment));
+    }
+
+    static void release_block(void *block, size_t size)
+    {
+      if (size >= kMappedBytes)
+        munmap(block, size);
+      else
+        std::free(block);
+    }
+
+    std::mutex mutex;
+    std::array<std::vector<void *>, 64> free_lists;
+    Stats stats_;
+    size_t max_cached_bytes = size_t(1) << 30;
+    std::atomic<bool> huge_pages{true};
+  };
+
+  // std::allocator replacement drawing from the ColumnArena.
+  template <typename T>
+  struct ArenaAllocator
+  {
+    using value_type = T;
+
+    ArenaAllocator() = default;
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+      return static_cast<T *>(ColumnArena::instance().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+      ColumnArena::instance().deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &) const { return true; }
+  };
+
+  // values of one column
+  template <typename T>
+  using ColumnVector = std::vector<T, ArenaAllocator<T>>;
+
+  // Arrow-style validity bitmap of a column: bit i % 64 of word i / 64 is
+  // set when value i is valid, clear when it is NULL. Bits past size() are
+  // clear, so bitmaps combine and count word by word. A column without a
+  // bitmap has no NULLs.
+  class ValidityBitmap
+  {
+  public:
+    ValidityBitmap() = default;
+
+    explicit ValidityBitmap(size_t length, bool valid = true)
+        : words((length + 63) / 64, valid ? ~uint64_t(0) : 0), length(length)
+    {
+      clear_tail();
+    }
+
+    // the length bits stored in bits, (length + 63) / 64 words
+    ValidityBitmap(const uint64_t *bits, size_t length)
+        : words(bits, bits + (length + 63) / 64), length(length)
+    {
+      clear_tail();
+    }
+
+    [[nodiscard]] size_t size() const { return length; }
+
+    // the words of the bitmap, (size() + 63) / 64 of them
+    [[nodiscard]] const uint64_t *data() const { return words.data(); }
+
+    [[nodiscard]] bool valid(size_t i) const { return words[i / 64] >> (i % 64) & 1; }
+
+    void set(size_t i, bool valid)
+    {
+      uint64_t bit = uint64_t(1) << (i % 64);
+      words[i / 64] = valid ? words[i / 64] | bit : words[i / 64] & ~bit;
+    }
+
+    void push_back(bool valid)
+    {
+      if (length % 64 == 0)
+        words.push_back(0);
+      length++;
+      set(length - 1, valid);
+    }
+
+    // append the bits of other
+    void append(const ValidityBitmap &other)
+    {
+      size_t shift = length % 64;
+      if (shift == 0)
+      {
+        words.insert(words.end(), other.words.begin(), other.words.end());
+      }
+      else
+      {
+        for (uint64_t word : other.words)
+        {
+          words.back() |= word << shift;
+          words.push_back(word >> (64 - shift));
+        }
+      }
+      length += other.length;
+      words.resize((length + 63) / 64);
+    }
+
+    [[nodiscard]] size_t null_count() const
+    {
+      size_t valid = 0;
+      for (uint64_t word : words)
+        valid += std::popcount(word);
+      return length - valid;
+    }
+
+    // bits [offset, offset + count)
+    [[nodiscard]] ValidityBitmap slice(size_t offset, size_t count) const
+    {
+      ValidityBitmap result(count, false);
+      size_t shift = offset % 64;
+      for (size_t w = 0; w < result.words.size(); ++w)
+      {
+        size_t source = offset / 64 + w;
+        uint64_t word = source < words.size() ? words[source] >> shift : 0;
+        if (shift != 0 && source + 1 < words.size())
+          word |= words[source + 1] << (64 - shift);
+        result.words[w] = word;
+      }
+      result.clear_tail();
+      return result;
+    }
+
+    // bits of the given rows, in that order
+    [[nodiscard]] ValidityBitmap take(const std::vector<size_t> &rows) const
+    {
+      ValidityBitmap result(rows.size(), false);
+      for (size_t i = 0; i < rows.size(); ++i)
+      {
+        if (valid(rows[i]))
+          result.words[i / 64] |= uint64_t(1) << (i % 64);
+      }
+      return result;
+    }
+
+    // valid in both, one AND per word
+    ValidityBitmap &operator&=(const ValidityBitmap &other)
+    {
+      for (size_t w = 0; w < words.size(); ++w)
+        words[w] &= other.words[w];
+      return *this;
+    }
+
+    // call fn(i) for every valid i in [begin, end), skipping NULLs a word
+    // at a time
+    template <typename Fn>
+    void for_each_valid(size_t begin, size_t end, Fn &&fn) const
+    {
+      for (size_t w = begin / 64; w * 64 < end; ++w)
+      {
+        uint64_t word = words[w];
+        if (w == begin / 64)
+          word &= ~uint64_t(0) << (begin % 64);
+        if ((w + 1) * 64 > end)
+          word &= ~(~uint64_t(0) << (end % 64));
+        while (word != 0)
+        {
+          fn(w * 64 + std::countr_zero(word));
+          word &= word - 1;
+        }
+      }
+    }
+
+  private:
+    void clear_tail()
+    {
+      if (length % 64 != 0)
+        words.back() &= ~(~uint64_t(0) << (length % 64));
+    }
+
+    ColumnVector<uint64_t> words;
+    size_t length = 0;
+  };
+} // namespace frame
+#endif // COLUMN_BUFFER_H
@@ -0,0 +1,420 @@
+#ifndef COLUMNAR_FILE_H
+#define COLUMNAR_FILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "dataframe.h"
+
+namespace frame
+{
+  // Binary columnar file of a Dataframe, loaded without parsing or copying:
+  //
+  //   ColumnarHeader
+  //   ColumnarColumn per column
+  //   column names, back to back
+  //   per column, each block at a multiple of 64 bytes: the values, then the
+  //   validity bitmap words if the column has NULLs
+  //   since version 2: ColumnarZone per row group and column, row group
+  //   major, at a multiple of 64 bytes, then the ColumnarFooter
+  //
+  // Row group g holds rows [g * row_group_rows, (g + 1) * row_group_rows) of
+  // every column, a contiguous range of each values block, so reading a row
+  // group reads only its own bytes. Integers are in the byte order of the
+  // machine that wrote the file. The version is raised on every change of
+  // the layout; readers reject the versions they do not know.
+  inline constexpr char kColumnarMagic[8] = {'F', 'R', 'A', 'M', 'E', 'C', 'O', 'L'};
+  inline constexpr uint32_t kColumnarVersion = 2;
+  inline constexpr size_t kColumnarAlignment = 64;
+
+  // ColumnarHeader::flags
+  inline constexpr uint32_t kColumnarChecksum = 1; // columns carry a checksum
+
+  struct ColumnarHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t num_rows;
+    uint32_t num_cols;
+    uint32_t value_type; // ArrowType of the values
+  };
+
+  struct ColumnarColumn
+  {
+    uint64_t name_offset;
+    uint64_t name_length;
+    uint64_t values_offset;
+    uint64_t validity_offset; // 0 when the column has no NULLs
+    uint64_t checksum;        // of the values and validity blocks
+  };
+
+  // zone map of one column in one row group
+  template <typename T>
+  struct ColumnarZone
+  {
+    T min; // of the valid values, meaningless when all of them are NULL
+    T max;
+    uint64_t null_count;
+  };
+
+  // last bytes of a file since version 2
+  struct ColumnarFooter
+  {
+    uint64_t row_group_rows; // the last row group may hold fewer
+    uint64_t zones_offset;
+    char magic[8];
+  };
+
+  struct ColumnarOptions
+  {
+    // checksum every column, checked by open_columnar with verify
+    bool checksum = true;
+    // rows per row group, the unit of zone maps and of partial reads
+    size_t row_group_rows = size_t(1) << 16;
+  };
+
+  // ArrowType stored for values of type T
+  template <typename T>
+  constexpr ArrowType columnar_type()
+  {
+    static_assert(std::is_arithmetic_v<T> && (sizeof(T) == 4 || sizeof(T) == 8),
+                  "columnar files hold 32 or 64-bit numbers");
+    if constexpr (std::is_floating_point_v<T>)
+      return sizeof(T) == 4 ? ArrowType::FLOAT : ArrowType::DOUBLE;
+    else
+      return sizeof(T) == 4 ? ArrowType::INT32 : ArrowType::INT64;
+  }
+
+  // FNV-1a over 8-byte words, the last one zero padded; chained through hash
+  inline uint64_t columnar_checksum(const char *bytes, size_t size,
+                                    uint64_t hash = 14695981039346656037ull)
+  {
+    constexpr uint64_t prime = 1099511628211ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+      uint64_t word;
+      std::memcpy(&word, bytes + i, 8);
+      hash = (hash ^ word) * prime;
+    }
+    if (i < size)
+    {
+      uint64_t word = 0;
+      std::memcpy(&word, bytes + i, size - i);
+      hash = (hash ^ word) * prime;
+    }
+    return hash;
+  }
+
+  inline size_t columnar_align(size_t offset)
+  {
+    return (offset + kColumnarAlignment - 1) / kColumnarAlignment * kColumnarAlignment;
+  }
+
+  // zone map of the rows [begin, end) of span
+  template <typename T>
+  ColumnarZone<T> columnar_zone(const ColumnSpan<T> &span, size_t begin, size_t end)
+  {
+    ColumnarZone<T> zone{T(), T(), 0};
+    size_t valid = 0;
+    auto add = [&](size_t i)
+    {
+      T value = span.data()[i];
+      zone.min = valid == 0 ? value : std::min(zone.min, value);
+      zone.max = valid == 0 ? value : std::max(zone.max, value);
+      valid++;
+    };
+    if (span.get_validity())
+    {
+      span.get_validity()->for_each_valid(begin, end, add);
+    }
+    else
+    {
+      for (size_t i = begin; i < end; ++i)
+        add(i);
+    }
+    zone.null_count = (end - begin) - valid;
+    return zone;
+  }
+
+  // Write the columns of view to filename in the columnar format.
+  template <typename T>
+  void write_columnar(const DataframeView<T> &view, const std::string &filename,
+                      const ColumnarOptions &options = {})
+  {
+    const size_t rows = view.num_rows();
+    const size_t cols = view.num_cols();
+    const size_t group_rows = std::max<size_t>(1, options.row_group_rows);
+    const size_t groups = (rows + group_rows - 1) / group_rows;
+    ColumnarHeader header{};
+    std::memcpy(header.magic, kColumnarMagic, sizeof(header.magic));
+    header.version = kColumnarVersion;
+    header.flags = options.checksum ? kColumnarChecksum : 0;
+    header.num_rows = rows;
+    header.num_cols = cols;
+    header.value_type = static_cast<uint32_t>(columnar_type<T>());
+
+    std::vector<ColumnarColumn> directory(cols);
+    size_t offset = sizeof(ColumnarHeader) + cols * sizeof(ColumnarColumn);
+    for (size_t c = 0; c < cols; ++c)
+    {
+      directory[c].name_offset = offset;
+      directory[c].name_length = view.get_column_str()[c].size();
+      offset += directory[c].name_length;
+    }
+    const size_t words = (rows + 63) / 64;
+    for (size_t c = 0; c < cols; ++c)
+    {
+      directory[c].values_offset = offset = columnar_align(offset);
+      offset += rows * sizeof(T);
+      if (view.get_column(c).get_validity())
+      {
+        directory[c].validity_offset = offset = columnar_align(offset);
+        offset += words * sizeof(uint64_t);
+      }
+    }
+    ColumnarFooter footer{group_rows, columnar_align(offset), {}};
+    std::memcpy(footer.magic, kColumnarMagic, sizeof(footer.magic));
+
+    if (options.checksum)
+    {
+      parallel_for(0, cols, 1, [&](size_t lo, size_t hi)
+                   {
+        for (size_t c = lo; c < hi; ++c)
+        {
+          const auto &span = view.get_column(c);
+          uint64_t hash = columnar_checksum(reinterpret_cast<const char *>(span.data()),
+                                            rows * sizeof(T));
+          if (span.get_validity())
+            hash = columnar_checksum(reinterpret_cast<const char *>(span.get_validity()->data()),
+                                     words * sizeof(uint64_t), hash);
+          directory[c].checksum = hash;
+        } });
+    }
+    std::vector<ColumnarZone<T>> zones(groups * cols);
+    parallel_for(0, groups, 1, [&](size_t lo, size_t hi)
+                 {
+      for (size_t g = lo; g < hi; ++g)
+      {
+        for (size_t c = 0; c < cols; ++c)
+          zones[g * cols + c] = columnar_zone(view.get_column(c), g * group_rows,
+                                              std::min(rows, (g + 1) * group_rows));
+      } });
+
+    std::ofstream writer(filename, std::ios::binary | std::ios::trunc);
+    if (!writer)
+      throw(std::invalid_argument(filename + std::string(" is invalid!")));
+    size_t written = 0;
+    auto write = [&](const void *bytes, size_t size, size_t at)
+    {
+      static const char padding[kColumnarAlignment] = {};
+      writer.write(padding, at - written);
+      writer.write(static_cast<const char *>(bytes), size);
+      written = at + size;
+    };
+    write(&header, sizeof(header), 0);
+    write(directory.data(), cols * sizeof(ColumnarColumn), written);
+    for (size_t c = 0; c < cols; ++c)
+      write(view.get_column_str()[c].data(), directory[c].name_length, written);
+    for (size_t c = 0; c < cols; ++c)
+    {
+      const auto &span = view.get_column(c);
+      write(span.data(), rows * sizeof(T), directory[c].values_offset);
+      if (span.get_validity())
+        write(span.get_validity()->data(), words * sizeof(uint64_t),
+              directory[c].validity_offset);
+    }
+    write(zones.data(), zones.size() * sizeof(ColumnarZone<T>), footer.zones_offset);
+    write(&footer, sizeof(footer), written);
+    if (!writer.flush())
+      throw(std::runtime_error("write " + filename + " failed"));
+  }
+
+  template <typename T>
+  void write_columnar(const Dataframe<T> &dataframe, const std::string &filename,
+                      const ColumnarOptions &options = {})
+  {
+    write_columnar(DataframeView<T>(dataframe), filename, options);
+  }
+
+  // A file written by write_columnar, mapped. The columns of view() and
+  // row_group() point into the mapping, which they keep alive, so opening
+  // reads only the header, the directory and the zone maps; pages are read
+  // when the values are first touched, and row_group() reads its rows
+  // ahead. Validity bitmaps, 1/32 of an int column, are copied. With
+  // verify, the checksums are checked, which reads the whole file.
+  // Version 1 files have no zone maps: they are one row group whose zone
+  // maps are computed on open.
+  template <typename T>
+  class ColumnarFile
+  {
+  public:
+    explicit ColumnarFile(const std::string &filename, bool verify = false)
+        : file(std::make_shared<const MappedFile>(filename, MADV_RANDOM))
+    {
+      const char *bytes = file->begin();
+      const size_t size = file->size();
+      auto invalid = [&](const std::string &reason)
+      {
+        return std::runtime_error(filename + " is not a columnar file: " + reason);
+      };
+      auto inside = [&](uint64_t offset, uint64_t length)
+      {
+        return offset <= size && length <= size - offset;
+      };
+
+      ColumnarHeader header;
+      if (size < sizeof(header))
+        throw invalid("truncated header");
+      std::memcpy(&header, bytes, sizeof(header));
+      if (std::memcmp(header.magic, kColumnarMagic, sizeof(header.magic)) != 0)
+        throw invalid("bad magic");
+      if (header.version == 0 || header.version > kColumnarVersion)
+        throw invalid("unknown version " + std::to_string(header.version));
+      if (header.value_type != static_cast<uint32_t>(columnar_type<T>()))
+        throw(std::invalid_argument(filename + " holds values of another type"));
+      const size_t rows = header.num_rows;
+      const size_t cols = header.num_cols;
+      if ((size - sizeof(header)) / sizeof(ColumnarColumn) < cols)
+        throw invalid("truncated directory");
+      std::vector<ColumnarColumn> directory(cols);
+      std::memcpy(directory.data(), bytes + sizeof(header), cols * sizeof(ColumnarColumn));
+
+      const size_t words = (rows + 63) / 64;
+      columns = DataframeView<T>(rows);
+      for (size_t c = 0; c < cols; ++c)
+      {
+        const ColumnarColumn &column = directory[c];
+        if (!inside(column.name_offset, column.name_length))
+          throw invalid("name past the end");
+        std::string name(bytes + column.name_offset, column.name_length);
+        if (column.values_offset % kColumnarAlignment != 0 ||
+            rows > size / sizeof(T) || !inside(column.values_offset, rows * sizeof(T)))
+          throw invalid("values of " + name + " past the end");
+        const char *values = bytes + column.values_offset;
+        const char *bits = bytes + column.validity_offset;
+        if (column.validity_offset != 0 &&
+            (column.validity_offset % kColumnarAlignment != 0 ||
+             !inside(column.validity_offset, words * sizeof(uint64_t))))
+          throw invalid("validity of " + name + " past the end");
+
+        if (verify && (header.flags & kColumnarChecksum))
+        {
+          uint64_t hash = columnar_checksum(values, rows * sizeof(T));
+          if (column.validity_offset != 0)
+            hash = columnar_checksum(bits, words * sizeof(uint64_t), hash);
+          if (hash != column.checksum)
+            throw(std::runtime_error("checksum mismatch in column " + name + " of " +
+                                     filename));
+        }
+        Validity validity;
+        if (column.validity_offset != 0)
+          validity = std::make_shared<const ValidityBitmap>(
+              reinterpret_cast<const uint64_t *>(bits), rows);
+        columns.insert(name, ColumnSpan<T>(reinterpret_cast<const T *>(values), rows, file,
+                                           std::move(validity)));
+      }
+
+      if (header.version < 2)
+      {
+        group_rows = std::max<size_t>(1, rows);
+        for (size_t c = 0; c < cols && rows > 0; ++c)
+          zones.push_back(columnar_zone(columns.get_column(c), 0, rows));
+        return;
+      }
+      ColumnarFooter footer;
+      if (size - sizeof(header) < sizeof(footer))
+        throw invalid("truncated footer");
+      std::memcpy(&footer, bytes + size - sizeof(footer), sizeof(footer));
+      if (std::memcmp(footer.magic, kColumnarMagic, sizeof(footer.magic)) != 0 ||
+          footer.row_group_rows == 0)
+        throw invalid("bad footer");
+      group_rows = footer.row_group_rows;
+      size_t groups = (rows + group_rows - 1) / group_rows;
+      if (groups > size / sizeof(ColumnarZone<T>) ||
+          !inside(footer.zones_offset, groups * cols * sizeof(ColumnarZone<T>)))
+        throw invalid("zone maps past the end");
+      zones.resize(groups * cols);
+      std::memcpy(zones.data(), bytes + footer.zones_offset,
+                  zones.size() * sizeof(ColumnarZone<T>));
+    }
+
+    [[nodiscard]] size_t num_rows() const { return columns.num_rows(); }
+
+    [[nodiscard]] size_t num_cols() const { return columns.num_cols(); }
+
+    [[nodiscard]] const std::vector<std::string> &get_column_str() const
+    {
+      return columns.get_column_str();
+    }
+
+    size_t col_index(const std::string &col) const { return columns.col_index(col); }
+
+    [[nodiscard]] size_t num_row_groups() const
+    {
+      return num_cols() == 0 ? 0 : zones.size() / num_cols();
+    }
+
+    // first row of row group g
+    [[nodiscard]] size_t row_group_offset(size_t g) const { return g * group_rows; }
+
+    [[nodiscard]] size_t row_group_size(size_t g) const
+    {
+      return std::min(num_rows(), (g + 1) * group_rows) - g * group_rows;
+    }
+
+    // zone map of column c in row group g
+    const ColumnarZone<T> &zone(size_t g, size_t c) const
+    {
+      if (g < num_row_groups() && c < num_cols())
+        return zones[g * num_cols() + c];
+      throw(std::out_of_range("no row group " + std::to_string(g) + " of column " +
+                              std::to_string(c)));
+    }
+
+    // all the rows, nothing read yet
+    [[nodiscard]] const DataframeView<T> &view() const { return columns; }
+
+    // the rows of row group g, read ahead
+    [[nodiscard]] DataframeView<T> row_group(size_t g) const
+    {
+      size_t first = row_group_offset(g);
+      size_t count = row_group_size(g);
+      advise_rows(first, count, MADV_WILLNEED);
+      return columns.slice(first, count);
+    }
+
+    // advise the pages of the values of rows [first, first + count)
+    void advise_rows(size_t first, size_t count, int advice) const
+    {
+      for (size_t c = 0; c < num_cols(); ++c)
+      {
+        size_t offset = reinterpret_cast<const char *>(columns.get_column(c).data() + first) -
+                        file->begin();
+        file->advise(offset, count * sizeof(T), advice);
+      }
+    }
+
+  private:
+    std::shared_ptr<const MappedFile> file;
+    DataframeView<T> columns;
+    size_t group_rows = 1;
+    std::vector<ColumnarZone<T>> zones; // row group major
+  };
+
+  // all the rows of a file written by write_columnar, see ColumnarFile
+  template <typename T>
+  DataframeView<T> open_columnar(const std::string &filename, bool verify = false)
+  {
+    return ColumnarFile<T>(filename, verify).view();
+  }
+} // namespace frame
+#endif // COLUMNAR_FILE_H
@@ -0,0 +1,352 @@
+#ifndef CSV_READER_H
+#define CSV_READER_H
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logical_expr.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace frame
+{
+  // Options of read_csv: which columns to load and, for some of them, their
+  // type. Fields of the other columns are split off but never parsed, and a
+  // column with a given type skips the inference of its values.
+  struct CsvOptions
+  {
+    char delimiter = ',';
+    // columns to load, in file order; all of them when empty
+    std::vector<std::string> columns;
+    // type of some of the columns, the others are inferred
+    std::unordered_map<std::string, ArrowType> types;
+  };
+
+  // Read-only mapping of a whole file, unmapped on destruction. The pages
+  // are advised for sequential access by default, so the kernel reads ahead.
+  class MappedFile
+  {
+  public:
+    explicit MappedFile(const std::string &filename, int advice = MADV_SEQUENTIAL)
+    {
+      int fd = open(filename.c_str(), O_RDONLY);
+      if (fd < 0)
+        throw(std::invalid_argument(filename + std::string(" is invalid!")));
+      struct stat info;
+      if (fstat(fd, &info) != 0)
+      {
+        close(fd);
+        throw(std::runtime_error("fstat " + filename + ": " + strerror(errno)));
+      }
+      length = info.st_size;
+      if (length > 0)
+      {
+        void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+          close(fd);
+          throw(std::runtime_error("mmap " + filename + ": " + strerror(errno)));
+        }
+        madvise(mapped, length, advice);
+        bytes = static_cast<const char *>(mapped);
+      }
+      close(fd);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+      if (bytes != nullptr)
+        munmap(const_cast<char *>(bytes), length);
+    }
+
+    [[nodiscard]] const char *begin() const { return bytes; }
+
+    [[nodiscard]] const char *end() const { return bytes + length; }
+
+    [[nodiscard]] size_t size() const { return length; }
+
+    // advise the pages of [offset, offset + count), e.g. MADV_WILLNEED to
+    // read them ahead
+    void advise(size_t offset, size_t count, int advice) const
+    {
+      size_t page = sysconf(_SC_PAGESIZE);
+      size_t start = offset / page * page;
+      if (bytes != nullptr && start < length)
+        madvise(const_cast<char *>(bytes) + start,
+                std::min(offset + count, length) - start, advice);
+    }
+
+  private:
+    const char *bytes = nullptr;
+    size_t length = 0;
+  };
+
+  // First byte of [p, end) equal to a or b, end if there is none. Compares
+  // 32 bytes per step with AVX2, 16 with SSE2, then finishes byte by byte.
+  inline const char *find_either(const char *p, const char *end, char a, char b)
+  {
+#if defined(__AVX2__)
+    const __m256i wide_a = _mm256_set1_epi8(a);
+    const __m256i wide_b = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32)
+    {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(
+          _mm256_cmpeq_epi8(block, wide_a), _mm256_cmpeq_epi8(block, wide_b)));
+      if (mask != 0)
+        return p + std::countr_zero(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i narrow_a = _mm_set1_epi8(a);
+    const __m128i narrow_b = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      uint32_t mask = _mm_movemask_epi8(_mm_or_si128(
+          _mm_cmpeq_epi8(block, narrow_a), _mm_cmpeq_epi8(block, narrow_b)));
+      if (mask != 0)
+        return p + std::countr_zero(mask);
+    }
+#endif
+    for (; p < end; ++p)
+    {
+      if (*p == a || *p == b)
+        return p;
+    }
+    return end;
+  }
+
+  // Split the row starting at cursor into fields, without the line break;
+  // returns the start of the next row. A field may be quoted ("a,b"), with
+  // doubled quotes inside ("say ""hi""") and line breaks; its view excludes
+  // the enclosing quotes, see unquote.
+  inline const char *split_csv_row(const char *cursor, const char *end, char delimiter,
+                                   std::vector<std::string_view> &fields)
+  {
+    fields.clear();
+    while (true)
+    {
+      const char *field = cursor;
+      const char *field_end;
+      const char *stop;
+      if (cursor < end && *cursor == '"')
+      {
+        // closing quote: a quote not followed by another one
+        const char *quote = cursor + 1;
+        while ((quote = find_either(quote, end, '"', '"')) + 1 < end && quote[1] == '"')
+          quote += 2;
+        field = cursor + 1;
+        field_end = std::min(quote, end);
+        stop = find_either(std::min(quote + 1, end), end, delimiter, '\n');
+      }
+      else
+      {
+        stop = find_either(cursor, end, delimiter, '\n');
+        field_end = stop;
+      }
+      if (stop == end || *stop == '\n')
+      {
+        if (field_end == stop && field_end > field && field_end[-1] == '\r')
+          --field_end;
+        fields.emplace_back(field, field_end - field);
+        return stop == end ? end : stop + 1;
+      }
+      fields.emplace_back(field, field_end - field);
+      cursor = stop + 1;
+    }
+  }
+
+  // field text with doubled quotes made single
+  inline std::string unquote(std::string_view field)
+  {
+    std::string text;
+    text.reserve(field.size());
+    for (size_t i = 0; i < field.size(); ++i)
+    {
+      text.push_back(field[i]);
+      if (field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"')
+        ++i;
+    }
+    return text;
+  }
+
+  // number of quote characters in [p, end)
+  inline size_t count_quotes(const char *p, const char *end)
+  {
+    size_t quotes = 0;
+    while ((p = find_either(p, end, '"', '"')) < end)
+    {
+      quotes++;
+      p++;
+    }
+    return quotes;
+  }
+
+  // start of the first row after p, given whether p is inside quotes: the
+  // byte after the first line break outside quotes, end if there is none
+  inline const char *next_row(const char *p, const char *end, bool quoted)
+  {
+    while ((p = find_either(p, end, '"', '\n')) < end)
+    {
+      if (*p == '\n' && !quoted)
+        return p + 1;
+      quoted ^= *p == '"';
+      p++;
+    }
+    return end;
+  }
+
+  // Cut [begin, end), which starts at a row, into at most parts ranges of
+  // about equal size that each start at a row: boundaries move forward to
+  // the next line break outside quotes. Whether a boundary is inside quotes
+  // comes from the parity of the quotes before it, counted per range in
+  // parallel. Returns the parts + 1 boundaries, some ranges may be empty.
+  inline std::vector<const char *> split_rows(const char *begin, const char *end, size_t parts)
+  {
+    if (begin == end)
+      return {begin, end};
+    parts = std::max<size_t>(1, parts);
+    size_t step = (end - begin + parts - 1) / parts;
+    std::vector<const char *> nominal(parts + 1, end);
+    for (size_t r = 0; r < parts; ++r)
+      nominal[r] = begin + std::min<size_t>(r * step, end - begin);
+    std::vector<size_t> quotes(parts);
+    parallel_for(0, parts, 1, [&](size_t lo, size_t hi)
+                 {
+      for (size_t r = lo; r < hi; ++r)
+        quotes[r] = count_quotes(nominal[r], nominal[r + 1]); });
+
+    std::vector<const char *> bounds(parts + 1, end);
+    bounds[0] = begin;
+    std::vector<bool> quoted(parts, false);
+    for (size_t r = 1; r < parts; ++r)
+      quoted[r] = quoted[r - 1] ^ (quotes[r - 1] % 2 == 1);
+    // scanning from the byte before the boundary keeps a boundary that
+    // already starts a row
+    parallel_for(1, parts, 1, [&](size_t lo, size_t hi)
+                 {
+      for (size_t r = lo; r < hi; ++r)
+      {
+        const char *before = nominal[r] - 1;
+        bounds[r] = next_row(before, end, quoted[r] != (*before == '"'));
+      } });
+    for (size_t r = 1; r <= parts; ++r)
+      bounds[r] = std::max(bounds[r], bounds[r - 1]);
+    return bounds;
+  }
+
+  // length of the first word of [begin, end)
+  inline size_t word_length(const char *begin, const char *end)
+  {
+    while (begin < end && std::isspace(static_cast<unsigned char>(*begin)))
+      ++begin;
+    const char *word = begin;
+    while (word < end && !std::isspace(static_cast<unsigned char>(*word)))
+      ++word;
+    return word - begin;
+  }
+
+  // Parse the csv field [begin, end) into value with std::from_chars:
+  // integers and decimals (optionally signed, with an exponent) convert to
+  // T, any other text stands for the length of its first word, as the
+  // stream based parse_cell of Dataframe does.
+  template <typename T>
+  void parse_field(const char *begin, const char *end, T &value)
+  {
+    static_assert(std::is_arithmetic_v<T>);
+    const char *p = begin;
+    if (p < end && *p == '+')
+      ++p;
+    const char *digits = p < end && *p == '-' ? p + 1 : p;
+    if (digits < end && (std::isdigit(static_cast<unsigned char>(*digits)) || *digits == '.'))
+    {
+      if constexpr (std::is_integral_v<T>)
+      {
+        long integer;
+        auto [stop, error] = std::from_chars(p, end, integer);
+        if (error == std::errc() && stop == end)
+        {
+          value = static_cast<T>(integer);
+          return;
+        }
+      }
+      double real;
+      auto [stop, error] = std::from_chars(p, end, real);
+      if (error == std::errc() && stop == end)
+      {
+        value = static_cast<T>(real);
+        return;
+      }
+    }
+    value = static_cast<T>(word_length(begin, end));
+  }
+
+  // Parse the csv field [begin, end) as a value of the given type, without
+  // inference; false if it is not one, or an INT32 out of its range (the
+  // value is then 0 and NULL). STRING fields stand for the length of their
+  // first word, as text does in parse_field.
+  template <typename T>
+  bool parse_typed_field(const char *begin, const char *end, ArrowType type, T &value)
+  {
+    static_assert(std::is_arithmetic_v<T>);
+    value = T();
+    if (begin < end && *begin == '+')
+      ++begin;
+    switch (type)
+    {
+    case ArrowType::INT32:
+    case ArrowType::INT64:
+    case ArrowType::BOOL:
+    {
+      long integer = 0;
+      auto [stop, error] = std::from_chars(begin, end, integer);
+      if (error != std::errc() || stop != end)
+        return false;
+      if (type == ArrowType::INT32 && (integer < std::numeric_limits<int32_t>::min() ||
+                                       integer > std::numeric_limits<int32_t>::max()))
+        return false;
+      value = static_cast<T>(integer);
+      return true;
+    }
+    case ArrowType::FLOAT:
+    case ArrowType::DOUBLE:
+    {
+      double real = 0;
+      auto [stop, error] = std::from_chars(begin, end, real);
+      if (error != std::errc() || stop != end)
+        return false;
+      value = static_cast<T>(real);
+      return true;
+    }
+    case ArrowType::STRING:
+      value = static_cast<T>(word_length(begin, end));
+      return true;
+    }
+    return false;
+  }
+} // namespace frame
+#endif // CSV_READER_H
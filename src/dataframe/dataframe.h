@@ -3,22 +3,41 @@
 #define Dataframe_H
 
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
 #include <exception>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
 #include <vector>
 
+#include "column_buffer.h"
+#include "csv_reader.h"
+#include "thread_pool.h"
+
 #define max_number_bit 50
 
+// rows per task of the parallel Dataframe operators
+#define parallel_grain 16384
+
+// rows from which sort_by switches to the parallel sample sort
+#define parallel_sort_threshold (1 << 20)
+
 typedef std::variant<char, int, long int, float, double, std::string>
     user_variant;
 
@@ -101,7 +120,7 @@ private:
 
 str_type get_string_type(const std::string &str)
 {
-  static isNumeric isnumeric;
+  thread_local isNumeric isnumeric;
   // directly return string_type while str.size() exceeds max_number_bit
   if (str.size() > max_number_bit)
     return string_type;
@@ -196,46 +215,498 @@ namespace frame
     };
   } // namespace toolbox
 
+  // one key of a multi-column sort_by; NULLs sort last unless nulls_first,
+  // whatever the direction
+  struct SortKey
+  {
+    std::string column;
+    bool descending = false;
+    bool nulls_first = false;
+  };
+
+  using Validity = std::shared_ptr<const ValidityBitmap>;
+
+  // value mapped to an unsigned integer of the same order, inverted for
+  // descending keys
+  template <typename T>
+  uint64_t normalized_key(T value, bool descending)
+  {
+    uint64_t key;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+      uint64_t bits = std::bit_cast<uint64_t>(static_cast<double>(value));
+      key = bits >> 63 ? ~bits : bits | (uint64_t(1) << 63);
+    }
+    else if constexpr (std::is_signed_v<T>)
+    {
+      key = static_cast<uint64_t>(static_cast<int64_t>(value)) ^ (uint64_t(1) << 63);
+    }
+    else
+    {
+      key = static_cast<uint64_t>(value);
+    }
+    return descending ? ~key : key;
+  }
+
+  // Permutation sorting rows on K columns of normalized keys, ties broken
+  // by row: the keys and the row of every row are packed into one array so
+  // the sort compares plain words.
+  template <size_t K, typename KeyFn>
+  std::vector<size_t> packed_sort_rows(size_t length, KeyFn &&key)
+  {
+    std::vector<std::array<uint64_t, K + 1>> items(length);
+    parallel_for(0, length, parallel_grain, [&](size_t lo, size_t hi)
+                 {
+      for (size_t i = lo; i < hi; ++i)
+      {
+        for (size_t k = 0; k < K; ++k)
+          items[i][k] = key(k, i);
+        items[i][K] = i;
+      } });
+    parallel_sort(items, std::less<>(), parallel_sort_threshold);
+    std::vector<size_t> rows(length);
+    parallel_for(0, length, parallel_grain, [&](size_t lo, size_t hi)
+                 {
+      for (size_t i = lo; i < hi; ++i)
+        rows[i] = items[i][K]; });
+    return rows;
+  }
+
+  template <typename T>
+  class Dataframe;
+
+  // Read-only window [offset, offset + length) over a column buffer. The
+  // buffer is reference counted, so a span outlives the frame it was taken
+  // from, and keeps its values: the frame copies a shared column before
+  // writing to it. The values may also live in other memory, such as a
+  // mapped file, that the span keeps alive through its owner. The validity
+  // bitmap, if any, covers the span's own rows.
+  template <typename T>
+  class ColumnSpan
+  {
+  public:
+    using Buffer = std::shared_ptr<const ColumnVector<T>>;
+    // keeps the values alive: a column buffer or a mapped file
+    using Owner = std::shared_ptr<const void>;
+
+    ColumnSpan() = default;
+
+    ColumnSpan(Buffer buffer, size_t offset, size_t length, Validity validity = nullptr)
+        : owner(buffer), validity(std::move(validity)),
+          base(buffer ? buffer->data() + offset : nullptr), length(length) {}
+
+    // span over all of values, which it takes over
+    explicit ColumnSpan(ColumnVector<T> &&values, Validity validity = nullptr)
+        : validity(std::move(validity))
+    {
+      auto buffer = std::make_shared<const ColumnVector<T>>(std::move(values));
+      base = buffer->data();
+      length = buffer->size();
+      owner = std::move(buffer);
+    }
+
+    // span over the length values at data, which owner keeps alive
+    ColumnSpan(const T *data, size_t length, Owner owner, Validity validity = nullptr)
+        : owner(std::move(owner)), validity(std::move(validity)), base(data),
+          length(length) {}
+
+    [[nodiscard]] size_t size() const { return length; }
+
+    [[nodiscard]] const T *data() const { return base; }
+
+    [[nodiscard]] const T *begin() const { return data(); }
+
+    [[nodiscard]] const T *end() const { return data() + length; }
+
+    const T &operator[](size_t i) const
+    {
+      if (i < length)
+        return data()[i];
+      throw(std::out_of_range("the index \'" + std::to_string(i) +
+                              "\' is out of range!"));
+    }
+
+    [[nodiscard]] ColumnSpan subspan(size_t start, size_t count) const
+    {
+      Validity sliced;
+      if (validity)
+        sliced = std::make_shared<const ValidityBitmap>(validity->slice(start, count));
+      return ColumnSpan(base + start, count, owner, std::move(sliced));
+    }
+
+    // NULL bitmap of the rows, nullptr when no row is NULL
+    [[nodiscard]] const Validity &get_validity() const { return validity; }
+
+    [[nodiscard]] bool is_valid(size_t i) const { return !validity || validity->valid(i); }
+
+    [[nodiscard]] std::vector<T> to_vector() const
+    {
+      return std::vector<T>(begin(), end());
+    }
+
+    // owner of the values, shared by the spans over the same memory
+    [[nodiscard]] const Owner &get_buffer() const { return owner; }
+
+  private:
+    Owner owner;
+    Validity validity;
+    const T *base = nullptr;
+    size_t length = 0;
+  };
+
+  // Position on one row of a DataframeView: the base pointers of the view's
+  // columns and a row number. Trivially copyable and unchecked, for row
+  // loops that must not allocate; valid while the view it came from lives.
+  template <typename T>
+  struct RowCursor
+  {
+    const T *const *columns;
+    size_t row;
+
+    const T &operator[](size_t c) const { return columns[c][row]; }
+
+    RowCursor &operator++()
+    {
+      ++row;
+      return *this;
+    }
+  };
+
+  // Non-owning Dataframe: named column spans over shared buffers. Slicing,
+  // partitioning and selecting columns copy no values; sort_by, take and
+  // to_dataframe materialize a Dataframe. Every Dataframe converts to a
+  // view of all its rows.
+  template <typename T>
+  class DataframeView
+  {
+  public:
+    using DataType = T;
+    using Span = ColumnSpan<T>;
+
+    DataframeView() = default;
+
+    DataframeView(const Dataframe<T> &dataframe) : length(dataframe.num_rows())
+    {
+      for (size_t c = 0; c < dataframe.num_cols(); ++c)
+      {
+        insert(dataframe.get_column_str()[c],
+               Span(dataframe.get_column(c).get_buffer(), 0, length,
+                    dataframe.get_column(c).get_validity()));
+      }
+    }
+
+    explicit DataframeView(size_t length) : length(length) {}
+
+    [[nodiscard]] size_t num_rows() const { return length; }
+
+    [[nodiscard]] size_t num_cols() const { return columns.size(); }
+
+    [[nodiscard]] const std::vector<std::string> &get_column_str() const { return column; }
+
+    bool contain(const std::string &col) const
+    {
+      return index.find(col) != index.end();
+    }
+
+    size_t col_index(const std::string &col) const
+    {
+      auto item = index.find(col);
+      if (item != index.end())
+      {
+        return item->second;
+      }
+      throw std::runtime_error("Column not found");
+    }
+
+    const Span &get_column(size_t i) const
+    {
+      if (i < columns.size())
+        return columns[i];
+      throw(std::out_of_range("the index \'" + std::to_string(i) +
+                              "\' is out of range!"));
+    }
+
+    // add a column, or replace the one of the same name
+    void insert(const std::string &col, Span span)
+    {
+      if (span.size() != length)
+        throw(std::invalid_argument("The length of the two is not the same"));
+      auto item = index.find(col);
+      if (item != index.end())
+      {
+        columns[item->second] = std::move(span);
+        bases[item->second] = columns[item->second].data();
+        return;
+      }
+      index.emplace(col, columns.size());
+      column.push_back(col);
+      columns.push_back(std::move(span));
+      bases.push_back(columns.back().data());
+    }
+
+    // cursor on row i
+    [[nodiscard]] RowCursor<T> row(size_t i) const
+    {
+      return RowCursor<T>{bases.data(), i};
+    }
+
+    // rows [offset, offset + count)
+    [[nodiscard]] DataframeView slice(size_t offset, size_t count) const
+    {
+      if (offset + count > length)
+        throw(std::out_of_range("slice past the end of the view"));
+      DataframeView view(count);
+      view.column = column;
+      view.index = index;
+      for (const auto &span : columns)
+      {
+        view.columns.push_back(span.subspan(offset, count));
+        view.bases.push_back(view.columns.back().data());
+      }
+      return view;
+    }
+
+    [[nodiscard]] DataframeView select(const std::vector<std::string> &names) const
+    {
+      DataframeView view(length);
+      for (const auto &name : names)
+      {
+        view.insert(name, get_column(col_index(name)));
+      }
+      return view;
+    }
+
+    // n consecutive slices, the last one takes the remainder
+    [[nodiscard]] std::vector<DataframeView> partition(size_t n) const
+    {
+      std::vector<DataframeView> views;
+      if (n == 0)
+        return views;
+      size_t part = length / n;
+      for (size_t i = 0; i < n; ++i)
+      {
+        views.push_back(slice(i * part, i == n - 1 ? length - i * part : part));
+      }
+      return views;
+    }
+
+    std::unordered_map<std::string, Metadata> min_max(const std::vector<std::string> &names) const
+    {
+      std::vector<Metadata> metadata(names.size());
+      TaskGroup group;
+      for (size_t k = 0; k < names.size(); ++k)
+      {
+        group.run([this, &names, &metadata, k]
+                  {
+          const auto &c = this->get_column(this->col_index(names[k]));
+          auto [min, max] = std::minmax_element(c.begin(), c.end());
+          metadata[k] = Metadata{.col_name = names[k], .min = *min, .max = *max}; });
+      }
+      group.wait();
+      std::unordered_map<std::string, Metadata> result;
+      for (auto &item : metadata)
+      {
+        result[item.col_name] = item;
+      }
+      return result;
+    }
+
+    // new Dataframe made of the given rows, in that order
+    Dataframe<T> take(const std::vector<size_t> &rows) const
+    {
+      Dataframe<T> dataframe = Dataframe<T>::create_empty_dataframe(rows.size());
+      for (size_t c = 0; c < columns.size(); ++c)
+      {
+        const T *source = columns[c].data();
+        ColumnVector<T> target(rows.size());
+        parallel_for(0, rows.size(), parallel_grain, [&](size_t lo, size_t hi)
+                     {
+          for (size_t i = lo; i < hi; ++i)
+            target[i] = source[rows[i]]; });
+        dataframe.insert(column[c], std::move(target));
+        if (const auto &validity = columns[c].get_validity())
+          dataframe.set_validity(column[c], std::make_shared<const ValidityBitmap>(validity->take(rows)));
+      }
+      return dataframe;
+    }
+
+    Dataframe<T> to_dataframe() const
+    {
+      Dataframe<T> dataframe = Dataframe<T>::create_empty_dataframe(length);
+      for (size_t c = 0; c < columns.size(); ++c)
+      {
+        dataframe.insert(column[c], ColumnVector<T>(columns[c].begin(), columns[c].end()));
+        dataframe.set_validity(column[c], columns[c].get_validity());
+      }
+      return dataframe;
+    }
+
+    Dataframe<T> sort_by(std::string column_name, bool descending = false) const
+    {
+      return sort_by({SortKey{std::move(column_name), descending}});
+    }
+
+    // sort lexicographically by several columns, each in its own direction;
+    // rows equal on every key keep their order
+    Dataframe<T> sort_by(const std::vector<SortKey> &keys) const
+    {
+      // a key column with NULLs sorts on a NULL flag first, then on its
+      // values with NULLs as 0 (ties among NULLs go by row)
+      std::vector<PackedKey> packed;
+      for (const auto &key : keys)
+      {
+        const Span &span = get_column(col_index(key.column));
+        const ValidityBitmap *validity = span.get_validity().get();
+        if (validity)
+          packed.push_back(PackedKey{nullptr, validity, key.descending, key.nulls_first, true});
+        packed.push_back(PackedKey{span.data(), validity, key.descending, key.nulls_first, false});
+      }
+      if constexpr (std::is_arithmetic_v<T>)
+      {
+        switch (packed.size())
+        {
+        case 1:
+          return take(sorted_rows<1>(packed));
+        case 2:
+          return take(sorted_rows<2>(packed));
+        case 3:
+          return take(sorted_rows<3>(packed));
+        case 4:
+          return take(sorted_rows<4>(packed));
+        }
+      }
+      // indirect comparison through the columns
+      std::vector<size_t> rows(length);
+      std::iota(rows.begin(), rows.end(), 0);
+      parallel_sort(rows, [&](size_t a, size_t b)
+                    {
+        for (const auto &key : packed)
+        {
+          if (key.null_flag)
+            continue;
+          bool valid_a = !key.validity || key.validity->valid(a);
+          bool valid_b = !key.validity || key.validity->valid(b);
+          if (valid_a != valid_b)
+            return valid_a != key.nulls_first;
+          if (!valid_a)
+            continue;
+          if (key.values[a] < key.values[b])
+            return !key.descending;
+          if (key.values[b] < key.values[a])
+            return key.descending;
+        }
+        return a < b; },
+                    parallel_sort_threshold);
+      return take(rows);
+    }
+
+  private:
+    // one column of the packed sort: the values of a key, or the NULL flag
+    // sorting before them
+    struct PackedKey
+    {
+      const T *values;
+      const ValidityBitmap *validity;
+      bool descending;
+      bool nulls_first;
+      bool null_flag;
+
+      [[nodiscard]] uint64_t operator()(size_t i) const
+      {
+        bool valid = !validity || validity->valid(i);
+        if (null_flag)
+          return valid == nulls_first;
+        return valid ? normalized_key(values[i], descending) : 0;
+      }
+    };
+
+    // rows in sort order on K arithmetic key columns
+    template <size_t K>
+    std::vector<size_t> sorted_rows(const std::vector<PackedKey> &packed) const
+    {
+      return packed_sort_rows<K>(length, [&](size_t k, size_t i)
+                                 { return packed[k](i); });
+    }
+
+    std::vector<std::string> column;
+    std::unordered_map<std::string, size_t> index;
+    std::vector<Span> columns;
+    std::vector<const T *> bases; // data() of every span, for RowCursor
+    size_t length = 0;
+  };
+
+  static_assert(std::is_trivially_copyable_v<RowCursor<int>>);
+
   template <typename T>
   class Dataframe
   {
   public:
     using DataType = T;
 
+    // Column values in a ColumnVector (64-byte aligned, from the column
+    // arena). Copies share the buffer until one of them is written to
+    // (copy on write), moves hand the buffer over; views hold the buffer too,
+    // so they keep the values they were taken with. An optional validity
+    // bitmap marks NULL values; it is shared the same way.
     class ColumnArray
     {
-      typedef typename std::vector<T>::const_iterator const_iter;
-      typedef typename std::vector<T>::iterator iter;
-      std::vector<T> *array = nullptr;
+      typedef typename ColumnVector<T>::const_iterator const_iter;
+      typedef typename ColumnVector<T>::iterator iter;
+      std::shared_ptr<ColumnVector<T>> array;
+      Validity validity;
+
+      // keep the bitmap in step when count values are inserted at offset
+      void splice_validity(size_t offset, size_t removed, size_t added)
+      {
+        if (!validity)
+          return;
+        ValidityBitmap bitmap = validity->slice(0, offset);
+        bitmap.append(ValidityBitmap(added));
+        bitmap.append(validity->slice(offset + removed, validity->size() - offset - removed));
+        validity = std::make_shared<const ValidityBitmap>(std::move(bitmap));
+      }
+
+      // Own the buffer before writing to it. Only writes detach: reads go
+      // through the const accessors, which never copy, whether the frame is
+      // const or not. Detaching is not synchronized, so a column written from
+      // several threads is detached once, through get_mutable_vector, before
+      // they start.
+      ColumnVector<T> &mutable_array()
+      {
+        if (array.use_count() > 1)
+          array = std::make_shared<ColumnVector<T>>(*array);
+        return *array;
+      }
 
     public:
-      explicit ColumnArray(int n = 0) { array = new std::vector<T>(n); }
+      explicit ColumnArray(int n = 0) { array = std::make_shared<ColumnVector<T>>(n); }
 
-      ColumnArray(const ColumnArray &_array)
-      {
-        array = new std::vector<T>(*_array.array);
-      }
+      ColumnArray(const ColumnArray &_array) : array(_array.array), validity(_array.validity) {}
 
       ColumnArray(ColumnArray &&_array) noexcept
+          : array(std::move(_array.array)), validity(std::move(_array.validity))
       {
-        array = new std::vector<T>(std::move(*_array.array));
+        _array.array = std::make_shared<ColumnVector<T>>();
       }
 
-      explicit ColumnArray(std::vector<T> &&_array)
+      explicit ColumnArray(ColumnVector<T> &&_array)
       {
-        array = new std::vector<T>(_array);
+        array = std::make_shared<ColumnVector<T>>(std::move(_array));
       }
 
       explicit ColumnArray(const std::vector<T> &_array)
       {
-        array = new std::vector<T>(_array);
+        array = std::make_shared<ColumnVector<T>>(_array.begin(), _array.end());
       }
 
-      ~ColumnArray() { delete array; }
-
-      void insert(const_iter position, const_iter start, const_iter end)
+      template <typename InputIt>
+      void insert(const_iter position, InputIt start, InputIt end)
       {
-        array->insert(position, start, end);
+        size_t offset = position - array->cbegin();
+        auto &values = mutable_array();
+        size_t before = values.size();
+        values.insert(values.begin() + offset, start, end);
+        splice_validity(offset, 0, values.size() - before);
       }
 
       [[nodiscard]] size_t size() const
@@ -249,13 +720,19 @@ namespace frame
 
       [[nodiscard]] const_iter end() const { return array->end(); }
 
-      [[nodiscard]] iter begin() { return array->begin(); }
-
-      [[nodiscard]] iter end() { return array->end(); }
-
-      void erase(const_iter i) { array->erase(i); }
+      void erase(const_iter i)
+      {
+        size_t offset = i - array->cbegin();
+        auto &values = mutable_array();
+        values.erase(values.begin() + offset);
+        splice_validity(offset, 1, 0);
+      }
 
-      void emplace_back(const T &item) { array->emplace_back(item); }
+      void emplace_back(const T &item)
+      {
+        mutable_array().emplace_back(item);
+        splice_validity(size() - 1, 0, 1);
+      }
 
       ColumnArray &operator=(const ColumnArray &other)
       {
@@ -263,8 +740,8 @@ namespace frame
         {
           if (other.size() == array->size())
           {
-            array->clear();
-            array->insert(array->begin(), other.begin(), other.end());
+            array = other.array;
+            validity = other.validity;
             return *this;
           }
           else
@@ -277,30 +754,50 @@ namespace frame
       {
         if (_array.size() == array->size())
         {
-          array->clear();
-          array->insert(array->begin(), _array.begin(), _array.end());
+          mutable_array().assign(_array.begin(), _array.end());
+          validity.reset();
           return *this;
         }
         throw(std::invalid_argument("The length of the two is not the same"));
       }
 
-      ColumnArray &operator=(std::vector<T> &&_array)
+      ColumnArray &operator=(ColumnVector<T> &&_array)
       {
         if (_array.size() == array->size())
         {
-          *array = _array;
+          array = std::make_shared<ColumnVector<T>>(std::move(_array));
+          validity.reset();
           return *this;
         }
         throw(std::invalid_argument("The length of the two is not the same"));
       }
 
-      [[maybe_unused]] [[nodiscard]] const std::vector<T> &
+      [[maybe_unused]] [[nodiscard]] const ColumnVector<T> &
       get_std_vector() const
       {
         return *array;
       }
 
-      [[maybe_unused]] std::vector<T> &get_std_vector() { return *array; }
+      // the values for writing, owned by this column alone
+      [[maybe_unused]] ColumnVector<T> &get_mutable_vector() { return mutable_array(); }
+
+      // shared buffer holding the values, for views
+      [[nodiscard]] std::shared_ptr<const ColumnVector<T>> get_buffer() const
+      {
+        return array;
+      }
+
+      // NULL bitmap, nullptr when no value is NULL
+      [[nodiscard]] const Validity &get_validity() const { return validity; }
+
+      void set_validity(Validity bitmap)
+      {
+        if (bitmap && bitmap->size() != size())
+          throw(std::invalid_argument("The length of the two is not the same"));
+        validity = std::move(bitmap);
+      }
+
+      [[nodiscard]] bool is_valid(size_t i) const { return !validity || validity->valid(i); }
 
       template<typename OutputType>
       std::vector<OutputType> as() {
@@ -341,10 +838,10 @@ namespace frame
         }
       }
 
-      T &operator[](size_t i)
+      void set(size_t i, const T &value)
       {
         if (i < array->size())
-          return (*array)[i];
+          mutable_array()[i] = value;
         else
         {
           std::stringstream ssTemp;
@@ -364,33 +861,34 @@ namespace frame
       }
     };
 
+    // Read-only view of one row: pointers to its values in the columns.
+    // Writes go through the columns, which copy shared storage first.
     class RowArray
     {
-      typedef typename std::vector<T *>::const_iterator const_iter;
-      typedef typename std::vector<T *>::iterator iter;
-      std::vector<T *> *array = nullptr;
+      typedef typename std::vector<const T *>::const_iterator const_iter;
+      std::vector<const T *> *array = nullptr;
 
     public:
-      explicit RowArray(int n = 0) { array = new std::vector<T *>(n); }
+      explicit RowArray(int n = 0) { array = new std::vector<const T *>(n); }
 
       RowArray(const RowArray &_array)
       {
-        array = new std::vector<T *>(*_array.array);
+        array = new std::vector<const T *>(*_array.array);
       }
 
       RowArray(RowArray &&_array) noexcept
       {
-        array = new std::vector<T *>(std::move(*_array.array));
+        array = new std::vector<const T *>(std::move(*_array.array));
       }
 
-      [[maybe_unused]] explicit RowArray(std::vector<T *> &&_array)
+      [[maybe_unused]] explicit RowArray(std::vector<const T *> &&_array)
       {
-        array = new std::vector<T *>(_array);
+        array = new std::vector<const T *>(_array);
       }
 
-      [[maybe_unused]] explicit RowArray(const std::vector<T *> &_array)
+      [[maybe_unused]] explicit RowArray(const std::vector<const T *> &_array)
       {
-        array = new std::vector<T *>(_array);
+        array = new std::vector<const T *>(_array);
       }
 
       ~RowArray() { delete array; }
@@ -411,74 +909,31 @@ namespace frame
 
       [[nodiscard]] const_iter end() const { return array->end(); }
 
-      [[nodiscard]] iter begin() { return array->begin(); }
-
-      [[nodiscard]] iter end() { return array->end(); }
-
       RowArray &operator=(const RowArray &other)
       {
         if (this != &other)
-        {
-          if (other.size() == array->size())
-          {
-            for (int i = 0; i < other.size(); ++i)
-            {
-              *(*array)[i] = other[i];
-            }
-            return *this;
-          }
-          else
-            throw(std::invalid_argument("The length of the two is not the same"));
-        }
+          *array = *other.array;
         return *this;
       }
 
-      RowArray &operator=(const std::vector<T> &_array)
-      {
-        if (_array.size() == array->size())
-        {
-          for (int i = 0; i < _array.size(); ++i)
-          {
-            *(*array)[i] = _array[i];
-          }
-          return *this;
-        }
-        throw(std::invalid_argument("The length of the two is not the same"));
-      }
-
-      RowArray &operator=(std::vector<T> &&_array)
-      {
-        if (_array.size() == array->size())
-        {
-          for (int i = 0; i < _array.size(); ++i)
-          {
-            *(*array)[i] = _array[i];
-          }
-          return *this;
-        }
-        throw(std::invalid_argument("The length of the two is not the same"));
-      }
-
-      [[maybe_unused]] const std::vector<T *> &get_point_vector() const
+      [[maybe_unused]] const std::vector<const T *> &get_point_vector() const
       {
         return *array;
       }
 
-      [[maybe_unused]] std::vector<T *> &get_point_vector() { return *array; }
-
       [[maybe_unused]] std::vector<T> get_std_vector() const
       {
         std::vector<T> result;
         if (array == nullptr)
           throw(std::invalid_argument("This row array is invalid!"));
-        for (T *item : *array)
+        for (const T *item : *array)
         {
           result.push_back(*item);
         }
         return result;
       }
 
-      void push_back(T *item) { array->emplace_back(item); }
+      void push_back(const T *item) { array->emplace_back(item); }
 
       const T &operator[](size_t i) const
       {
@@ -493,19 +948,6 @@ namespace frame
         }
       }
 
-      T &operator[](size_t i)
-      {
-        if (i < array->size())
-          return *((*array)[i]);
-        else
-        {
-          std::stringstream ssTemp;
-          ssTemp << i;
-          throw(std::out_of_range("the index \'" + ssTemp.str() +
-                                  "\' is out of range!"));
-        }
-      }
-
       friend std::ostream &operator<<(std::ostream &cout, RowArray &arr)
       {
         for (const auto &item : *arr.array)
@@ -552,11 +994,9 @@ namespace frame
 
     // copy constructor
     Dataframe(const Dataframe &dataframe)
-        : dataframe_name(dataframe.dataframe_name), width(dataframe.width),
-          length(dataframe.length), column(dataframe.column),
-          index(dataframe.index)
+        : dataframe_name(dataframe.dataframe_name), column(dataframe.column),
+          width(dataframe.width), length(dataframe.length), index(dataframe.index)
     {
-      matrix.clear();
       for (auto i = dataframe.matrix.begin(); i < dataframe.matrix.end(); ++i)
       {
         matrix.emplace_back(new ColumnArray(**i));
@@ -566,14 +1006,16 @@ namespace frame
     // move constructor
     Dataframe(Dataframe &&dataframe) noexcept
         : dataframe_name(dataframe.dataframe_name),
-          column(std::move(dataframe.column)), width(dataframe.width), length(dataframe.length),
+          column(std::move(dataframe.column)), matrix(std::move(dataframe.matrix)),
+          width(dataframe.width), length(dataframe.length),
           index(std::move(dataframe.index))
     {
-      matrix.clear();
-      for (auto i = dataframe.matrix.begin(); i < dataframe.matrix.end(); ++i)
-      {
-        matrix.emplace_back(new ColumnArray(std::move(**i)));
-      }
+      // the columns changed hands, leave dataframe empty
+      dataframe.column.clear();
+      dataframe.matrix.clear();
+      dataframe.index.clear();
+      dataframe.width = 0;
+      dataframe.length = 0;
     }
 
     ~Dataframe()
@@ -651,13 +1093,13 @@ namespace frame
         ++width;
         column.emplace_back("row_index");
         index.emplace("row_index", index.size());
-        std::vector<T> row_index_values;
+        ColumnVector<T> row_index_values;
         row_index_values.reserve(length);
         for (long int i = 0; i < length; ++i) {
           T value = i;
           row_index_values.push_back(value);
         }
-        matrix.push_back(new ColumnArray(row_index_values));
+        matrix.push_back(new ColumnArray(std::move(row_index_values)));
       }
     }
 
@@ -689,8 +1131,8 @@ namespace frame
         return false;
     }
 
-    // insert one column from std::vector<T>
-    bool insert(const std::string &col, std::vector<T> &&array)
+    // insert one column, taking its values over
+    bool insert(const std::string &col, ColumnVector<T> &&array)
     {
       if (array.size() == num_rows())
       {
@@ -699,14 +1141,14 @@ namespace frame
           ++width;
           column.emplace_back(col);
           index.emplace(col, index.size());
-          matrix.emplace_back(new ColumnArray(array));
+          matrix.emplace_back(new ColumnArray(std::move(array)));
         }
         else
         {
           ColumnArray &line = this->operator[](col);
           if (line.size() == array.size())
           {
-            line = array;
+            line = std::move(array);
           }
           else
             throw(std::invalid_argument("The length of the two is not the same"));
@@ -745,6 +1187,12 @@ namespace frame
         return false;
     }
 
+    // mark the NULL values of a column, nullptr when it has none
+    void set_validity(const std::string &col, Validity validity)
+    {
+      this->operator[](col).set_validity(std::move(validity));
+    }
+
     // remove one column from str
     bool remove(const std::string &col)
     {
@@ -786,27 +1234,6 @@ namespace frame
       }
     }
 
-    // get one row data from index of row
-    RowArray operator[](size_t i)
-    {
-      if (i < length)
-      {
-        RowArray RowArray;
-        for (auto &item : matrix)
-        {
-          RowArray.push_back(&((*item)[i]));
-        }
-        return RowArray;
-      }
-      else
-      {
-        std::stringstream ssTemp;
-        ssTemp << i;
-        throw(std::out_of_range("the index \'" + ssTemp.str() +
-                                "\' is out of range!"));
-      }
-    }
-
     // get one row data from index of row
     RowArray operator[](size_t i) const
     {
@@ -930,114 +1357,73 @@ namespace frame
         return false;
     }
 
-    // partition the Dataframe in n parts
-    std::vector<Dataframe<DataType>> partition(size_t n)
+    // view of all rows, sharing the column buffers
+    DataframeView<T> view() const { return DataframeView<T>(*this); }
+
+    // partition the Dataframe in n parts, as views over its columns
+    std::vector<DataframeView<T>> partition(size_t n) const
     {
-      std::vector<Dataframe<DataType>> dataframes;
-      if (n > 0)
-      {
-        size_t part = length / n;
-        size_t last = length % n;
-        size_t start = 0;
-        for (size_t i = 0; i < n; ++i)
-        {
-          Dataframe<DataType> dataframe;
-          size_t dataframe_length;
-          if (i == n - 1)
-          {
-            dataframe_length = part + last;
-          }
-          else
-          {
-            dataframe_length = part;
-          }
-          dataframe.column_paste(this->get_column_str());
-          for (size_t j = start; j < start + dataframe_length;
-               ++j)
-          {
-            dataframe.append(this->get_row(j).get_std_vector());
-          }
-          start += dataframe_length;
-          dataframes.emplace_back(std::move(dataframe));
-        }
-      }
-      return dataframes;
+      return view().partition(n);
     }
 
     // sort dataframe by x column
     Dataframe sort_by(std::string column_name, bool descending = false) const
     {
-      Dataframe dataframe;
-      dataframe.column_paste(this->get_column_str());
-      auto index = this->col_index(column_name);
-      auto column = this->get_column(index);
-      std::vector<std::pair<T, size_t>> sort_vector;
-      for (size_t i = 0; i < column.size(); ++i)
-      {
-        sort_vector.emplace_back(column[i], i);
-      }
-      if (descending) {
-        std::sort(sort_vector.begin(), sort_vector.end(), std::greater<>());
-      } else {
-        std::sort(sort_vector.begin(), sort_vector.end(), std::less<>());
-      }
-      for (auto &item : sort_vector)
-      {
-        dataframe.append(this->get_row(item.second).get_std_vector());
-      }
-      return dataframe;
+      return view().sort_by(std::move(column_name), descending);
     }
 
-    // compute min_max values
-    std::unordered_map<std::string, Metadata> min_max(const std::vector<std::string>& columns)
+    // sort dataframe lexicographically by several columns, each in its own
+    // direction; rows equal on every key keep their order
+    Dataframe sort_by(const std::vector<SortKey> &keys) const
     {
-      std::unordered_map<std::string, Metadata> result;
-      for (auto col_name : columns)
-      {
-        auto index = this->col_index(col_name);
-        auto c = this->get_column(index);
-        auto min = *std::min_element(c.begin(), c.end());
-        auto max = *std::max_element(c.begin(), c.end());
-        result[col_name] = Metadata{.col_name=col_name, .min = min, .max = max};
-      }
-      return result;
+      return view().sort_by(keys);
+    }
+
+    // new Dataframe made of the given rows, in that order
+    Dataframe take(const std::vector<size_t> &rows) const
+    {
+      return view().take(rows);
     }
 
+    // compute min_max values
+    std::unordered_map<std::string, Metadata> min_max(const std::vector<std::string>& columns) const
+    {
+      return view().min_max(columns);
+    }
 
-    // select columns from Dataframe
-    Dataframe select(std::vector<std::string> columns) const
+    // select columns from Dataframe, as a view over them
+    DataframeView<T> select(const std::vector<std::string> &columns) const
     {
-      Dataframe dataframe;
-      dataframe.length = length;
-      for (auto &column_name : columns)
-      {
-        auto index = this->col_index(column_name);
-        auto series = this->get_column(index);
-        dataframe.insert(column_name, series);
-      }
-      return dataframe;
+      return view().select(columns);
     }
 
     // compute cross join for condition x == y
     Dataframe cross_join(Dataframe &dataframe, std::string x, std::string y)
     {
+      // columns of both sides, "_r" marks right names taken on the left
+      string_vector names = this->get_column_str();
+      for (const auto &name : dataframe.get_column_str())
+      {
+        names.push_back(contain(name) ? name + "_r" : name);
+      }
       Dataframe result;
-      result.column_paste(this->get_column_str());
-      result.column_paste(dataframe.get_column_str());
-      auto index_x = this->col_index(x);
-      auto index_y = dataframe.col_index(y);
-      auto column_x = this->get_column(index_x);
-      auto column_y = dataframe.get_column(index_y);
-      for (size_t i = 0; i < column_x.size(); ++i)
-      {
-        for (size_t j = 0; j < column_y.size(); ++j)
+      result.column_paste(names);
+      DataframeView<T> left = view();
+      DataframeView<T> right = dataframe.view();
+      size_t index_x = left.col_index(x);
+      size_t index_y = right.col_index(y);
+      std::vector<T> row(left.num_cols() + right.num_cols());
+      for (auto left_row = left.row(0); left_row.row < left.num_rows(); ++left_row)
+      {
+        for (auto right_row = right.row(0); right_row.row < right.num_rows(); ++right_row)
         {
-          if (column_x[i] == column_y[j])
+          if (left_row[index_x] == right_row[index_y])
           {
-            std::vector<T> row_x = this->get_row(i).get_std_vector();
-            std::vector<T> row_y = dataframe.get_row(j).get_std_vector();
-            row_x.insert(row_x.end(), row_y.begin(), row_y.end());
-            result.append(row_x);
+            for (size_t c = 0; c < left.num_cols(); ++c)
+              row[c] = left_row[c];
+            for (size_t c = 0; c < right.num_cols(); ++c)
+              row[left.num_cols() + c] = right_row[c];
+            result.append(row);
           }
         }
       }
@@ -1119,11 +1505,10 @@ namespace frame
       dataframe_name = dataframe.dataframe_name;
       column = std::move(dataframe.column);
       index = std::move(dataframe.index);
-      matrix.clear();
-      for (auto i = dataframe.matrix.begin(); i < dataframe.matrix.end(); ++i)
-      {
-        matrix.emplace_back(new ColumnArray(std::move(**i)));
-      }
+      matrix = std::move(dataframe.matrix);
+      dataframe.matrix.clear();
+      dataframe.width = 0;
+      dataframe.length = 0;
       return *this;
     }
 
@@ -1146,36 +1531,76 @@ namespace frame
       return *this;
     }
 
-    // read from csv file
+    // Read from csv file. The file is mapped and cut into byte ranges that
+    // start at a row (quoted line breaks included) and are parsed in
+    // parallel: a first pass counts the rows of every range, a second one
+    // parses each range straight into its rows of the column buffers, so
+    // nothing is concatenated afterwards. Fields are found with a SIMD scan
+    // for the delimiter and newline and parsed with from_chars; rows with a
+    // wrong number of fields are skipped, empty fields are NULL.
     void read_csv(std::string_view filename, const char &delimiter = ',')
     {
-      clear();
-      std::ifstream reader(filename.data());
-      if (!reader)
-      {
-        throw(std::invalid_argument(filename.data() + std::string(" is invalid!")));
-      }
+      CsvOptions options;
+      options.delimiter = delimiter;
+      read_csv(filename, options);
+    }
 
-      std::string str_line;
-      string_vector value_str_vector;
-      if (getline(reader, str_line))
-      {
-        value_str_vector.clear();
-        if (splite_line(str_line, value_str_vector, delimiter))
+    // read the columns of options.columns only, parsing the fields of the
+    // columns in options.types as that type without inference
+    void read_csv(std::string_view filename, const CsvOptions &options)
+    {
+      clear();
+      MappedFile file{std::string(filename)};
+      const char *end = file.end();
+      const char delimiter = options.delimiter;
+
+      std::vector<std::string_view> fields;
+      const char *body = split_csv_row(file.begin(), end, delimiter, fields);
+      string_vector header;
+      CsvLayout layout = csv_layout(fields, options, header);
+      if (!column_paste(header))
+        return;
+
+      // about 1 MiB per range, a few ranges per worker
+      size_t workers = TaskScheduler::instance().num_workers();
+      size_t parts = std::min<size_t>(4 * workers, (end - body) / (1 << 20) + 1);
+      std::vector<const char *> bounds = split_rows(body, end, parts);
+      size_t num_ranges = bounds.size() - 1;
+      std::vector<size_t> first_row(num_ranges + 1, 0);
+      parallel_for(0, num_ranges, 1, [&](size_t lo, size_t hi)
+                   {
+        for (size_t r = lo; r < hi; ++r)
+          first_row[r + 1] = count_rows(bounds[r], bounds[r + 1], delimiter, layout); });
+      std::partial_sum(first_row.begin(), first_row.end(), first_row.begin());
+      length = first_row.back();
+
+      std::vector<ColumnVector<T>> values;
+      for (size_t i = 0; i < width; ++i)
+        values.emplace_back(length);
+      std::vector<std::vector<ValidityBitmap>> validity(num_ranges);
+      parallel_for(0, num_ranges, 1, [&](size_t lo, size_t hi)
+                   {
+        for (size_t r = lo; r < hi; ++r)
         {
-          column_paste(value_str_vector);
-        }
-      }
+          validity[r].resize(width);
+          parse_rows(bounds[r], bounds[r + 1], delimiter, layout, first_row[r], values,
+                     validity[r]);
+        } });
 
-      while (getline(reader, str_line))
+      for (size_t i = 0; i < width; ++i)
       {
-        value_str_vector.clear();
-        if (splite_line(str_line, value_str_vector, delimiter))
-        {
-          append_from_str(value_str_vector);
-        }
+        delete matrix[i];
+        matrix[i] = new ColumnArray(std::move(values[i]));
+        size_t nulls = 0;
+        for (const auto &range : validity)
+          nulls += range[i].null_count();
+        if (nulls == 0)
+          continue;
+        ValidityBitmap bitmap;
+        for (const auto &range : validity)
+          bitmap.append(range[i]);
+        matrix[i]->set_validity(std::make_shared<const ValidityBitmap>(std::move(bitmap)));
       }
-      reader.close();
     }
 
     // write into csv file
@@ -1185,54 +1610,53 @@ namespace frame
       to_csv(dataframe_name, delimiter);
     }
 
+    // Write the header and rows as an ostream with default flags would,
+    // without going through one: chunks of rows are formatted in parallel
+    // with to_chars into one buffer each, and the buffers are written in
+    // order with large write calls. Chunks are formatted a wave of a few
+    // per worker at a time, so the memory in use does not grow with the
+    // frame. NULLs are written as empty fields.
     void to_csv(const std::string &filename, const char &delimiter = ',') const
     {
-      std::ofstream cout =
-          std::ofstream(filename, std::ios::out | std::ios::trunc);
-      for (auto item = column.begin(); item < column.end() - 1; ++item)
+      int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+        throw(std::invalid_argument(filename + std::string(" is invalid!")));
+      try
       {
-        cout << *item << delimiter;
-      }
-      cout << column.back() << '\n';
-      for (size_t i = 0; i < num_rows(); ++i)
-      {
-        for (auto array = matrix.begin(); array < matrix.end() - 1; ++array)
+        std::string header;
+        for (size_t c = 0; c < column.size(); ++c)
         {
-          std::visit(overloaded{
-                         [&cout](char value)
-                         { cout << value; },
-                         [&cout](int value)
-                         { cout << value; },
-                         [&cout](long int value)
-                         { cout << value; },
-                         [&cout](float value)
-                         { cout << value; },
-                         [&cout](double value)
-                         { cout << value; },
-                         [&cout](const std::string &value)
-                         { cout << value; },
-                     },
-                     user_variant((**array)[i]));
-          cout << delimiter;
+          header += column[c];
+          header.push_back(c + 1 < column.size() ? delimiter : '\n');
+        }
+        write_all(fd, header.data(), header.size());
+
+        const size_t chunk_rows = 16384;
+        size_t num_chunks = column.empty() ? 0 : (length + chunk_rows - 1) / chunk_rows;
+        size_t wave = 4 * TaskScheduler::instance().num_workers();
+        std::vector<std::string> buffers(std::min(wave, num_chunks));
+        for (size_t first = 0; first < num_chunks; first += wave)
+        {
+          size_t chunks = std::min(wave, num_chunks - first);
+          parallel_for(0, chunks, 1, [&](size_t lo, size_t hi)
+                       {
+            for (size_t k = lo; k < hi; ++k)
+            {
+              size_t begin = (first + k) * chunk_rows;
+              format_csv_rows(begin, std::min(length, begin + chunk_rows), delimiter,
+                              buffers[k]);
+            } });
+          for (size_t k = 0; k < chunks; ++k)
+            write_all(fd, buffers[k].data(), buffers[k].size());
         }
-        std::visit(overloaded{
-                       [&cout](char value)
-                       { cout << value; },
-                       [&cout](int value)
-                       { cout << value; },
-                       [&cout](long int value)
-                       { cout << value; },
-                       [&cout](float value)
-                       { cout << value; },
-                       [&cout](double value)
-                       { cout << value; },
-                       [&cout](const std::string &value)
-                       { cout << value; },
-                   },
-                   user_variant((*matrix.back())[i]));
-        cout << '\n';
       }
-      cout.close();
+      catch (...)
+      {
+        close(fd);
+        throw;
+      }
+      if (close(fd) != 0)
+        throw(std::runtime_error("close " + filename + ": " + strerror(errno)));
     }
 
     // print Dataframe
@@ -1392,27 +1816,6 @@ namespace frame
                               "\' is out of range!"));
     }
 
-    // get one row data from index of row
-    [[maybe_unused]] RowArray get_row(size_t i)
-    {
-      if (i < length)
-      {
-        RowArray RowArray;
-        for (auto &item : matrix)
-        {
-          RowArray.push_back(&((*item)[i]));
-        }
-        return RowArray;
-      }
-      else
-      {
-        std::stringstream ssTemp;
-        ssTemp << i;
-        throw(std::out_of_range("the index \'" + ssTemp.str() +
-                                "\' is out of range!"));
-      }
-    }
-
     // get one row data from index of row
     [[maybe_unused]] const RowArray get_row(size_t i) const
     {
@@ -1466,80 +1869,9 @@ namespace frame
       if (value_str_vector.size() == column.size())
       {
         length++;
-        std::stringstream stream;
-        user_variant item;
         for (size_t i = 0; i < value_str_vector.size(); ++i)
         {
-          stream.clear();
-          stream << value_str_vector[i];
-          str_type type = get_string_type(value_str_vector[i]);
-          if (type == int_type)
-          {
-            long int temp;
-            stream >> temp;
-            item = temp;
-          }
-          else if (type == float_type)
-          {
-            double temp;
-            stream >> temp;
-            item = temp;
-          }
-          else
-          {
-            std::string temp;
-            stream >> temp;
-            if (std::is_arithmetic_v<T>) {
-              item = (T)temp.size();
-            } else {
-              item = temp;
-            }
-          }
-
-          std::visit(
-              overloaded{
-                  [&](char value)
-                  {
-                    if (typeid(value) == typeid(T) ||
-                        is_same_type<T, user_variant>())
-                      matrix[i]->emplace_back(T(value));
-                  },
-                  [&](int value)
-                  {
-                    if (typeid(value) == typeid(T) ||
-                        is_same_type<T, user_variant>())
-                      matrix[i]->emplace_back(T(value));
-                  },
-                  [&](long int value)
-                  {
-                    if (is_numeric_type<T>() || is_same_type<T, user_variant>())
-                      matrix[i]->emplace_back(T(value));
-                  },
-                  [&](float value)
-                  {
-                    if (typeid(value) == typeid(T) ||
-                        is_same_type<T, user_variant>())
-                      matrix[i]->emplace_back(T(value));
-                  },
-                  [&](double value)
-                  {
-                    if (is_numeric_type<T>() || is_same_type<T, user_variant>())
-                      matrix[i]->emplace_back(T(value));
-                  },
-                  [&](const std::string &value)
-                  {
-                    if (typeid(value) == typeid(T) ||
-                        is_same_type<T, user_variant>())
-                    {
-                      toolbox::user_stringstream uss;
-                      uss << value;
-                      T temp;
-                      uss >> temp;
-                      matrix[i]->emplace_back(temp);
-                    }
-                  },
-              },
-              item);
+          parse_cell(value_str_vector[i], matrix[i]->get_mutable_vector());
         }
         return true;
       }
@@ -1547,6 +1879,267 @@ namespace frame
         return false;
     }
 
+    // rows [begin, end) as to_csv writes them, into buffer
+    void format_csv_rows(size_t begin, size_t end, char delimiter, std::string &buffer) const
+    {
+      std::vector<const T *> values(width);
+      std::vector<const ValidityBitmap *> validity(width);
+      for (size_t c = 0; c < width; ++c)
+      {
+        values[c] = matrix[c]->get_buffer()->data();
+        validity[c] = matrix[c]->get_validity().get();
+      }
+      buffer.clear();
+      buffer.reserve((end - begin) * width * 12);
+      for (size_t i = begin; i < end; ++i)
+      {
+        for (size_t c = 0; c < width; ++c)
+        {
+          // NULL is an empty field, as read_csv reads it
+          if (validity[c] == nullptr || validity[c]->valid(i))
+            append_csv_value(buffer, values[c][i]);
+          buffer.push_back(c + 1 < width ? delimiter : '\n');
+        }
+      }
+    }
+
+    // append value as an ostream with default flags prints it: integers in
+    // full, floating point numbers as %g with 6 significant digits
+    static void append_csv_value(std::string &out, const T &value)
+    {
+      auto append = [&out](auto number)
+      {
+        using Number = decltype(number);
+        if constexpr (std::is_same_v<Number, char>)
+        {
+          out.push_back(number);
+        }
+        else
+        {
+          char digits[32];
+          std::to_chars_result written;
+          if constexpr (std::is_floating_point_v<Number>)
+            written = std::to_chars(digits, digits + sizeof(digits), static_cast<double>(number),
+                                    std::chars_format::general, 6);
+          else
+            written = std::to_chars(digits, digits + sizeof(digits), number);
+          out.append(digits, written.ptr);
+        }
+      };
+      if constexpr (std::is_arithmetic_v<T>)
+      {
+        append(value);
+      }
+      else
+      {
+        std::visit(overloaded{
+                       [&out](const std::string &text)
+                       { out += text; },
+                       [&append](auto number) -> void
+                       { append(number); },
+                   },
+                   user_variant(value));
+      }
+    }
+
+    static void write_all(int fd, const char *bytes, size_t size)
+    {
+      while (size > 0)
+      {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          throw(std::runtime_error(std::string("write: ") + strerror(errno)));
+        }
+        bytes += written;
+        size -= written;
+      }
+    }
+
+    // how the fields of a csv row map to the columns: the field of every
+    // column and its type, if given
+    struct CsvLayout
+    {
+      size_t num_fields;
+      std::vector<size_t> fields;
+      std::vector<std::optional<ArrowType>> types;
+
+      // whether the fields of a row make a row of the frame
+      [[nodiscard]] bool is_row(const std::vector<std::string_view> &row) const
+      {
+        return row.size() == num_fields && !(num_fields == 1 && row[0].empty());
+      }
+    };
+
+    // layout of the rows under the header row fields, with the columns of
+    // options; their names are appended to header
+    static CsvLayout csv_layout(const std::vector<std::string_view> &fields,
+                                const CsvOptions &options, std::vector<std::string> &header)
+    {
+      CsvLayout layout{fields.size(), {}, {}};
+      for (size_t f = 0; f < fields.size(); ++f)
+      {
+        std::string name = unquote(fields[f]);
+        if (!options.columns.empty() &&
+            std::find(options.columns.begin(), options.columns.end(), name) ==
+                options.columns.end())
+          continue;
+        auto type = options.types.find(name);
+        layout.fields.push_back(f);
+        layout.types.push_back(type == options.types.end() ? std::nullopt
+                                                           : std::optional(type->second));
+        header.push_back(std::move(name));
+      }
+      for (const auto &name : options.columns)
+      {
+        if (std::find(header.begin(), header.end(), name) == header.end())
+          throw std::runtime_error("Column not found");
+      }
+      return layout;
+    }
+
+    // number of rows in [cursor, end)
+    static size_t count_rows(const char *cursor, const char *end, char delimiter,
+                             const CsvLayout &layout)
+    {
+      size_t rows = 0;
+      std::vector<std::string_view> fields;
+      while (cursor < end)
+      {
+        cursor = split_csv_row(cursor, end, delimiter, fields);
+        rows += layout.is_row(fields);
+      }
+      return rows;
+    }
+
+    // parse the rows of [cursor, end), at most limit of them, into values
+    // from row first, and into validity, one entry per column; the fields of
+    // other columns are not parsed. Returns the start of the rows left.
+    static const char *parse_rows(const char *cursor, const char *end, char delimiter,
+                                  const CsvLayout &layout, size_t first,
+                                  std::vector<ColumnVector<T>> &values,
+                                  std::vector<ValidityBitmap> &validity,
+                                  size_t limit = std::numeric_limits<size_t>::max())
+    {
+      size_t row = first;
+      std::vector<std::string_view> fields;
+      fields.reserve(layout.num_fields);
+      while (cursor < end && row - first < limit)
+      {
+        cursor = split_csv_row(cursor, end, delimiter, fields);
+        if (!layout.is_row(fields))
+          continue;
+        for (size_t i = 0; i < layout.fields.size(); ++i)
+        {
+          const std::string_view &field = fields[layout.fields[i]];
+          validity[i].push_back(!field.empty() &&
+                                parse_value(field, layout.types[i], values[i][row]));
+        }
+        row++;
+      }
+      return cursor;
+    }
+
+    // parse a non-empty field into value, as type if given; false if the
+    // field is not of that type
+    static bool parse_value(std::string_view field, const std::optional<ArrowType> &type,
+                            T &value)
+    {
+      if constexpr (std::is_arithmetic_v<T>)
+      {
+        if (type)
+          return parse_typed_field(field.data(), field.data() + field.size(), *type, value);
+        parse_field(field.data(), field.data() + field.size(), value);
+      }
+      else
+      {
+        std::vector<T> parsed;
+        parse_cell(unquote(field), parsed);
+        if (!parsed.empty())
+          value = parsed.back();
+      }
+      return true;
+    }
+
+    // parse one csv field and append it to values
+    template <typename Values>
+    static void parse_cell(const std::string &value_str, Values &values)
+    {
+      std::stringstream stream;
+      user_variant item;
+      stream << value_str;
+      str_type type = get_string_type(value_str);
+      if (type == int_type)
+      {
+        long int temp;
+        stream >> temp;
+        item = temp;
+      }
+      else if (type == float_type)
+      {
+        double temp;
+        stream >> temp;
+        item = temp;
+      }
+      else
+      {
+        std::string temp;
+        stream >> temp;
+        if (std::is_arithmetic_v<T>) {
+          item = (T)temp.size();
+        } else {
+          item = temp;
+        }
+      }
+
+      std::visit(
+          overloaded{
+              [&](char value)
+              {
+                if (typeid(value) == typeid(T) ||
+                    is_same_type<T, user_variant>())
+                  values.emplace_back(T(value));
+              },
+              [&](int value)
+              {
+                if (typeid(value) == typeid(T) ||
+                    is_same_type<T, user_variant>())
+                  values.emplace_back(T(value));
+              },
+              [&](long int value)
+              {
+                if (is_numeric_type<T>() || is_same_type<T, user_variant>())
+                  values.emplace_back(T(value));
+              },
+              [&](float value)
+              {
+                if (typeid(value) == typeid(T) ||
+                    is_same_type<T, user_variant>())
+                  values.emplace_back(T(value));
+              },
+              [&](double value)
+              {
+                if (is_numeric_type<T>() || is_same_type<T, user_variant>())
+                  values.emplace_back(T(value));
+              },
+              [&](const std::string &value)
+              {
+                if (typeid(value) == typeid(T) ||
+                    is_same_type<T, user_variant>())
+                {
+                  toolbox::user_stringstream uss;
+                  uss << value;
+                  T temp;
+                  uss >> temp;
+                  values.emplace_back(temp);
+                }
+              },
+          },
+          item);
+    }
+
     std::string dataframe_name;
     std::vector<std::string> column;
     std::vector<ColumnArray *> matrix;
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "iejoin.h"
+
+// Out-of-core IEJoin. The (rid, X, Y) tuples of both inputs are sorted on X
+// into runs that fit the memory budget and spilled to local disk, merged,
+// and cut into range partitions. Each pair of partitions whose key ranges can
+// satisfy the predicates is joined in memory, and the pairs are streamed to a
+// sink in batches, so neither the sorted arrays nor the result are ever fully
+// resident.
+
+struct ExternalJoinOptions {
+  // bytes of join state (sorted runs, partitions, result batch) kept in memory
+  size_t memory_budget = size_t(256) << 20;
+  // parent of the spill directory; the system temp directory when empty
+  std::string spill_dir;
+  // pairs handed to the sink per call
+  size_t batch_size = size_t(1) << 16;
+};
+
+// Disk traffic of one ExternalIEJoin call.
+struct SpillStats {
+  size_t bytes_written = 0;
+  size_t bytes_read = 0;
+  size_t runs = 0;            // sorted runs spilled, both sides
+  size_t partitions = 0;      // range partitions, both sides
+  size_t partition_pairs = 0; // partition pairs joined after pruning
+};
+
+namespace external {
+
+struct KeyRecord {
+  int rid;
+  DataType x;
+  DataType y;
+};
+
+// rough bytes per row held by IEJoin for a partition: the projected and
+// sorted frames, permutation arrays, offsets and the bit-array
+constexpr size_t kJoinBytesPerRow = 24 * sizeof(DataType);
+
+struct PartitionInfo {
+  size_t offset; // first record in the sorted file
+  size_t count;
+  DataType min_x, max_x, min_y, max_y;
+};
+
+// Unique directory for the spill files of one join, removed on destruction.
+class SpillDirectory {
+public:
+  explicit SpillDirectory(const std::string &parent) {
+    static std::atomic<int> counter{0};
+    std::filesystem::path base =
+        parent.empty() ? std::filesystem::temp_directory_path()
+                       : std::filesystem::path(parent);
+    path = base / ("iejoin-" + std::to_string(getpid()) + "-" +
+                   std::to_string(counter++));
+    std::filesystem::create_directories(path);
+  }
+
+  ~SpillDirectory() {
+    std::error_code error;
+    std::filesystem::remove_all(path, error);
+  }
+
+  std::string file(const std::string &name) const { return path / name; }
+
+private:
+  std::filesystem::path path;
+};
+
+// spill files, opened or std::runtime_error: a spill that cannot be written
+// or read back must not pass for a short result
+std::ofstream OpenSpill(const std::string &path) {
+  std::ofstream writer(path, std::ios::binary | std::ios::trunc);
+  if (!writer) {
+    throw std::runtime_error("cannot create spill file " + path);
+  }
+  return writer;
+}
+
+std::ifstream OpenSpilled(const std::string &path) {
+  std::ifstream reader(path, std::ios::binary);
+  if (!reader) {
+    throw std::runtime_error("cannot open spill file " + path);
+  }
+  return reader;
+}
+
+void WriteRecords(std::ofstream &writer, const std::vector<KeyRecord> &records,
+                  SpillStats &stats) {
+  size_t bytes = records.size() * sizeof(KeyRecord);
+  writer.write(reinterpret_cast<const char *>(records.data()), bytes);
+  if (!writer) {
+    throw std::runtime_error("writing a spill file failed");
+  }
+  stats.bytes_written += bytes;
+}
+
+// flush and close a spill file, reporting write errors
+void CloseSpill(std::ofstream &writer) {
+  writer.close();
+  if (!writer) {
+    throw std::runtime_error("writing a spill file failed");
+  }
+}
+
+// read up to count records, returns how many were read: fewer only at the
+// end of the file
+size_t ReadRecords(std::ifstream &reader, std::vector<KeyRecord> &records,
+                   size_t count, SpillStats &stats) {
+  records.resize(count);
+  reader.read(reinterpret_cast<char *>(records.data()),
+              count * sizeof(KeyRecord));
+  if (reader.bad() || (reader.fail() && !reader.eof())) {
+    throw std::runtime_error("reading a spill file failed");
+  }
+  size_t read = reader.gcount() / sizeof(KeyRecord);
+  records.resize(read);
+  stats.bytes_read += read * sizeof(KeyRecord);
+  return read;
+}
+
+bool ByX(const KeyRecord &a, const KeyRecord &b) {
+  return a.x < b.x || (a.x == b.x && a.rid < b.rid);
+}
+
+// Sort the (rid, X, Y) records of table on X into one file: sorted runs of at
+// most run_rows records are spilled, then merged in a single k-way pass.
+std::string ExternalSort(const DataFrameView &table, const std::string &X,
+                         const std::string &Y, size_t run_rows,
+                         const SpillDirectory &dir, const std::string &name,
+                         SpillStats &stats) {
+  const ColumnSpan &xs = table.get_column(table.col_index(X));
+  const ColumnSpan &ys = table.get_column(table.col_index(Y));
+  frame::Validity valid = ValidRows(table, {X, Y});
+  size_t n = table.num_rows();
+
+  std::vector<std::string> runs;
+  std::vector<KeyRecord> buffer;
+  buffer.reserve(std::min(run_rows, n));
+  for (size_t start = 0; start < n; start += run_rows) {
+    size_t end = std::min(n, start + run_rows);
+    buffer.clear();
+    ForEachValid(valid, start, end, [&](size_t r) {
+      buffer.push_back(KeyRecord{static_cast<int>(r), xs[r], ys[r]});
+    });
+    std::sort(buffer.begin(), buffer.end(), ByX);
+    runs.push_back(dir.file(name + ".run" + std::to_string(runs.size())));
+    std::ofstream writer = OpenSpill(runs.back());
+    WriteRecords(writer, buffer, stats);
+    CloseSpill(writer);
+  }
+  stats.runs += runs.size();
+  if (runs.size() == 1) {
+    return runs[0];
+  }
+
+  // k-way merge, every run read through a buffer of equal share
+  std::string merged = dir.file(name + ".sorted");
+  std::ofstream writer = OpenSpill(merged);
+  size_t share = std::max<size_t>(1, run_rows / (runs.size() + 1));
+  std::vector<std::ifstream> readers;
+  std::vector<std::vector<KeyRecord>> blocks(runs.size());
+  std::vector<size_t> cursor(runs.size(), 0);
+  for (size_t k = 0; k < runs.size(); ++k) {
+    readers.push_back(OpenSpilled(runs[k]));
+    ReadRecords(readers[k], blocks[k], share, stats);
+  }
+  auto greater = [&](size_t a, size_t b) {
+    return ByX(blocks[b][cursor[b]], blocks[a][cursor[a]]);
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(
+      greater);
+  for (size_t k = 0; k < runs.size(); ++k) {
+    if (!blocks[k].empty()) {
+      heap.push(k);
+    }
+  }
+  std::vector<KeyRecord> output;
+  output.reserve(share);
+  while (!heap.empty()) {
+    size_t k = heap.top();
+    heap.pop();
+    output.push_back(blocks[k][cursor[k]]);
+    if (output.size() == share) {
+      WriteRecords(writer, output, stats);
+      output.clear();
+    }
+    if (++cursor[k] == blocks[k].size()) {
+      cursor[k] = 0;
+      ReadRecords(readers[k], blocks[k], share, stats);
+    }
+    if (!blocks[k].empty()) {
+      heap.push(k);
+    }
+  }
+  WriteRecords(writer, output, stats);
+  CloseSpill(writer);
+  for (const auto &run : runs) {
+    std::filesystem::remove(run);
+  }
+  return merged;
+}
+
+// Partition of the count records at records, which start at offset of the
+// sorted order: its place and the X and Y range of its keys.
+PartitionInfo DescribePartition(const KeyRecord *records, size_t offset,
+                                size_t count) {
+  PartitionInfo info{offset, count, records[0].x, records[count - 1].x,
+                     records[0].y, records[0].y};
+  for (size_t r = 0; r < count; ++r) {
+    info.min_y = std::min(info.min_y, records[r].y);
+    info.max_y = std::max(info.max_y, records[r].y);
+  }
+  return info;
+}
+
+// Cut records sorted on X into range partitions of at most rows records.
+std::vector<PartitionInfo> RangePartition(const std::vector<KeyRecord> &records,
+                                          size_t rows) {
+  std::vector<PartitionInfo> partitions;
+  for (size_t offset = 0; offset < records.size(); offset += rows) {
+    size_t count = std::min(rows, records.size() - offset);
+    partitions.push_back(
+        DescribePartition(records.data() + offset, offset, count));
+  }
+  return partitions;
+}
+
+// Cut a file sorted on X into range partitions of at most rows records.
+std::vector<PartitionInfo> RangePartition(const std::string &sorted,
+                                          size_t rows, SpillStats &stats) {
+  std::vector<PartitionInfo> partitions;
+  std::ifstream reader = OpenSpilled(sorted);
+  std::vector<KeyRecord> block;
+  size_t offset = 0;
+  while (ReadRecords(reader, block, rows, stats) > 0) {
+    partitions.push_back(DescribePartition(block.data(), offset, block.size()));
+    offset += block.size();
+  }
+  stats.partitions += partitions.size();
+  return partitions;
+}
+
+// The count records at records as a (row_index, X, Y) frame; rids receives
+// the global row id of every local row.
+DataFrame PartitionFrame(const KeyRecord *records, size_t count,
+                         const std::string &X, const std::string &Y,
+                         std::vector<int> &rids) {
+  std::vector<DataType> xs, ys;
+  rids.clear();
+  for (size_t r = 0; r < count; ++r) {
+    rids.push_back(records[r].rid);
+    xs.push_back(records[r].x);
+    ys.push_back(records[r].y);
+  }
+  DataFrame frame = DataFrame::create_empty_dataframe(count);
+  frame.create_row_index();
+  frame.insert(X, std::move(xs));
+  if (Y != X) {
+    frame.insert(Y, std::move(ys));
+  }
+  return frame;
+}
+
+// Load a partition of a sorted file as PartitionFrame does.
+DataFrame LoadPartition(const std::string &sorted, const PartitionInfo &info,
+                        const std::string &X, const std::string &Y,
+                        std::vector<int> &rids, SpillStats &stats) {
+  std::ifstream reader = OpenSpilled(sorted);
+  reader.seekg(info.offset * sizeof(KeyRecord));
+  std::vector<KeyRecord> block;
+  if (ReadRecords(reader, block, info.count, stats) != info.count) {
+    throw std::runtime_error("spill file " + sorted + " is truncated");
+  }
+  return PartitionFrame(block.data(), block.size(), X, Y, rids);
+}
+
+} // namespace external
+
+// IEJoin of T and Tr (predicates as in IEJoin) within options.memory_budget
+// bytes of join state, spilling sorted runs to local disk. Pairs of global
+// row ids are handed to sink in batches; returns the spill volume.
+SpillStats ExternalIEJoin(const DataFrameView &T, const DataFrameView &Tr,
+                          const std::vector<Predicate> &preds,
+                          const JoinSink &sink,
+                          const ExternalJoinOptions &options = {}) {
+  using namespace external;
+  SpillStats stats;
+  SpillDirectory dir(options.spill_dir);
+  auto op_name1 = preds[0].operator_name;
+  auto op_name2 = preds[1].operator_name;
+
+  size_t batch_bytes = options.batch_size * sizeof(std::pair<int, int>);
+  size_t budget = options.memory_budget > batch_bytes
+                      ? options.memory_budget - batch_bytes
+                      : options.memory_budget / 2;
+  // sorting holds one run; joining holds a partition of each side
+  size_t run_rows = std::max<size_t>(1, budget / sizeof(KeyRecord));
+  size_t partition_rows = std::max<size_t>(1, budget / (2 * kJoinBytesPerRow));
+
+  std::string left = ExternalSort(T, preds[0].lhs, preds[1].lhs, run_rows, dir,
+                                  "left", stats);
+  std::string right = ExternalSort(Tr, preds[0].rhs, preds[1].rhs, run_rows,
+                                   dir, "right", stats);
+  auto left_parts = RangePartition(left, partition_rows, stats);
+  auto right_parts = RangePartition(right, partition_rows, stats);
+
+  std::vector<std::pair<int, int>> batch;
+  batch.reserve(options.batch_size);
+  std::vector<int> left_rids, right_rids;
+  for (const auto &lp : left_parts) {
+    DataFrame L;
+    bool loaded = false;
+    for (const auto &rp : right_parts) {
+      if (!may_satisfy(op_name1, lp.min_x, lp.max_x, rp.min_x, rp.max_x) ||
+          !may_satisfy(op_name2, lp.min_y, lp.max_y, rp.min_y, rp.max_y)) {
+        continue;
+      }
+      if (!loaded) {
+        L = LoadPartition(left, lp, preds[0].lhs, preds[1].lhs, left_rids,
+                          stats);
+        loaded = true;
+      }
+      DataFrame R = LoadPartition(right, rp, preds[0].rhs, preds[1].rhs,
+                                  right_rids, stats);
+      stats.partition_pairs += 1;
+
+      IEJoinIndex index = PrepareIEJoin(L, R, preds);
+      boost::dynamic_bitset<> B(index.n);
+      IEJoinSweep(index, B, [](int) {}, [&](int i, int off1) {
+        while (true) {
+          int k = FindFrom(B, off1);
+          if (k >= index.n or k == -1) {
+            break;
+          }
+          batch.emplace_back(left_rids[index.Li[i]], right_rids[index.Lk[k]]);
+          if (batch.size() == options.batch_size) {
+            sink(batch);
+            batch.clear();
+          }
+          off1 = k + 1;
+        }
+      });
+    }
+  }
+  if (!batch.empty()) {
+    sink(batch);
+  }
+  return stats;
+}
@@ -2,7 +2,11 @@
 #include <cinttypes>
 #include <iostream>
 
+#include "adaptive_bitset.h"
+#include "batch_reader.h"
+#include "columnar_file.h"
 #include "dataframe.h"
+#include "typed_dataframe.h"
 
 #include <array>
 #include <iostream>
@@ -11,8 +15,10 @@
 
 #include <boost/dynamic_bitset.hpp>
 #include <functional>
+#include <limits>
 #include <iostream>
 #include <map>
+#include <numeric>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -22,7 +28,11 @@ using DataType = int;
 using DataFrame = frame::Dataframe<DataType>;
 using RowArray = DataFrame::RowArray;
 using ColumnArray = DataFrame::ColumnArray;
+using DataFrameView = frame::DataframeView<DataType>;
+using ColumnSpan = frame::ColumnSpan<DataType>;
+using RowCursor = frame::RowCursor<DataType>;
 using StringArray = std::vector<std::string>;
+using AdaptiveBitset = frame::AdaptiveBitset;
 
 // PrintArray function
 void PrintArray(std::string_view name, const DataFrame &L) {
@@ -69,6 +79,52 @@ std::function<bool(DataType, DataType)> get_operator_fn(const kOperator op) {
   }
 }
 
+// a op b without the indirect call of get_operator_fn, for row loops
+inline bool Compare(const kOperator op, DataType a, DataType b) {
+  switch (op) {
+  case kLess:
+    return a < b;
+  case kLessEqual:
+    return a <= b;
+  case kGreater:
+    return a > b;
+  case kGreaterEqual:
+    return a >= b;
+  case kEqual:
+    return a == b;
+  case kNotEqual:
+    return a != b;
+  default:
+    throw std::runtime_error("Unknown operator");
+  }
+}
+
+// operator obtained by swapping the operands: a op b <=> b Flip(op) a
+kOperator FlipOperator(const kOperator op) {
+  switch (op) {
+  case kLess:
+    return kGreater;
+  case kLessEqual:
+    return kGreaterEqual;
+  case kGreater:
+    return kLess;
+  case kGreaterEqual:
+    return kLessEqual;
+  default:
+    return op;
+  }
+}
+
+bool IsStrict(const kOperator op) {
+  return op == kLess || op == kGreater || op == kNotEqual;
+}
+
+// <, <=, > or >=: an order on the keys, which the sweeps rely on
+bool IsOrdering(const kOperator op) {
+  return op == kLess || op == kLessEqual || op == kGreater ||
+         op == kGreaterEqual;
+}
+
 struct Predicate {
   std::string operator_ref;
   kOperator operator_name;
@@ -80,18 +136,84 @@ struct Predicate {
   }
 };
 
+// Rows valid (not NULL) in every column of cols: the column bitmaps ANDed
+// word by word, nullptr when none of the columns has NULLs.
+frame::Validity ValidRows(const DataFrameView &table, const StringArray &cols) {
+  std::shared_ptr<frame::ValidityBitmap> valid;
+  for (const auto &col : cols) {
+    const auto &validity = table.get_column(table.col_index(col)).get_validity();
+    if (!validity) {
+      continue;
+    }
+    if (!valid) {
+      valid = std::make_shared<frame::ValidityBitmap>(*validity);
+    } else {
+      *valid &= *validity;
+    }
+  }
+  return valid;
+}
+
+// fn(row) for the rows of [begin, end) set in valid, or all of them
+template <typename Fn>
+void ForEachValid(const frame::Validity &valid, size_t begin, size_t end,
+                  Fn &&fn) {
+  if (valid) {
+    valid->for_each_valid(begin, end, fn);
+  } else {
+    for (size_t row = begin; row < end; ++row) {
+      fn(row);
+    }
+  }
+}
+
+// name of cols[c] in ArrayOf: a column that repeats gets primes, so every
+// entry of cols has its own position
+std::string ArrayName(const StringArray &cols, size_t c) {
+  std::string name = cols[c];
+  for (size_t k = 0; k < c; ++k) {
+    if (cols[k] == cols[c]) {
+      name += "'";
+    }
+  }
+  return name;
+}
+
 // create a view  and the <iota | view>
-DataFrame ArrayOf(const DataFrame &table, const StringArray &cols) {
-  // Project the predicate columns and a row id as tuples: (rid, X, ...)
-  DataFrame result = DataFrame::create_empty_dataframe(table.num_rows());
-  // Add a row id column
-  result.create_row_index();
+DataFrameView ArrayOf(const DataFrameView &table, const StringArray &cols) {
+  // Project the predicate columns and a row id as tuples: (rid, X, ...);
+  // only the row id column is new, the others share the table buffers
+  frame::Validity valid = ValidRows(table, cols);
+  if (!valid) {
+    DataFrameView result(table.num_rows());
+    frame::ColumnVector<DataType> row_index(table.num_rows());
+    std::iota(row_index.begin(), row_index.end(), 0);
+    result.insert("row_index", ColumnSpan(std::move(row_index)));
+
+    for (size_t c = 0; c < cols.size(); ++c) {
+      auto index = table.col_index(cols[c]);
+      result.insert(ArrayName(cols, c), table.get_column(index));
+    }
+    return result;
+  }
 
+  // rows with a NULL key can satisfy no predicate: gather the others
+  frame::ColumnVector<DataType> row_index;
+  row_index.reserve(table.num_rows() - valid->null_count());
+  ForEachValid(valid, 0, table.num_rows(),
+               [&](size_t row) { row_index.push_back(row); });
+  std::vector<frame::ColumnVector<DataType>> gathered;
   for (auto col_name : cols) {
-    auto index = table.col_index(col_name);
-
-    DataFrame::ColumnArray column = table.get_column(index);
-    result.insert(col_name, column);
+    const ColumnSpan &values = table.get_column(table.col_index(col_name));
+    gathered.emplace_back(row_index.size());
+    for (size_t i = 0; i < row_index.size(); ++i) {
+      gathered.back()[i] = values[row_index[i]];
+    }
+  }
+  DataFrameView result(row_index.size());
+  result.insert("row_index", ColumnSpan(std::move(row_index)));
+  for (size_t c = 0; c < cols.size(); ++c) {
+    result.insert(ArrayName(cols, c), ColumnSpan(std::move(gathered[c])));
   }
   return result;
 }
@@ -99,113 +221,245 @@ DataFrame ArrayOf(const DataFrame &table, const StringArray &cols) {
 void Mark(DataFrame &L) {
   // Add a marked column that will become P
   // [ ... P]
-  std::vector<DataFrame::DataType> p_values;
+  frame::ColumnVector<DataFrame::DataType> p_values;
   p_values.reserve(L.num_rows());
   for (int p = 0; p < L.num_rows(); p++) {
     p_values.push_back(p);
   }
-  L.insert("p", p_values);
+  L.insert("p", std::move(p_values));
 }
 
 ColumnArray ExtractColumn(const DataFrame &table, const int &column) {
   return table.get_column(column);
 }
 
-std::vector<std::tuple<int, int>> LoopJoin(const DataFrame &left,
-                                           const DataFrame &right,
+// Boundaries of the runs of equal keys in a sorted column, computed in one
+// pass: for every position the first index of its run (strict = false) or the
+// first index after it (strict = true). Lookups are O(1) however many
+// duplicates a key has.
+std::vector<int> RunBounds(const ColumnArray &L, bool strict) {
+  int n = L.size();
+  std::vector<int> bounds(n);
+  int start = 0;
+  while (start < n) {
+    int end = start + 1;
+    while (end < n && L[end] == L[start]) {
+      end += 1;
+    }
+    std::fill(bounds.begin() + start, bounds.begin() + end,
+              strict ? end : start);
+    start = end;
+  }
+  return bounds;
+}
+
+// first set bit at or after off; find_next(off - 1) misses bit 0 for off = 0
+template <typename BitArray>
+size_t FindFrom(const BitArray &B, int off) {
+  return off == 0 ? B.find_first() : B.find_next(off - 1);
+}
+
+std::vector<std::tuple<int, int>> LoopJoin(const DataFrameView &left,
+                                           const DataFrameView &right,
                                            const std::vector<Predicate> &preds,
                                            int trace = 0) {
-  std::vector<std::tuple<int, int>> result;
-
-  for (size_t i = 0; i < left.num_rows(); i++) {
-    for (size_t j = 0; j < right.num_rows(); j++) {
-      const RowArray &left_row = left.get_row(i);
-      const RowArray &right_row = right.get_row(j);
-      bool matching = true;
-      for (const Predicate &pred : preds) {
-        auto left_row_index = left.col_index(pred.lhs);
-        auto right_row_index = right.col_index(pred.rhs);
-        if (!pred.condition()(left_row[left_row_index],
-                              right_row[right_row_index])) {
-          matching = false;
-          break;
+  // predicate columns resolved once, outside the row loops
+  std::vector<size_t> left_columns, right_columns;
+  std::vector<kOperator> operators;
+  StringArray left_names, right_names;
+  for (const Predicate &pred : preds) {
+    left_columns.push_back(left.col_index(pred.lhs));
+    right_columns.push_back(right.col_index(pred.rhs));
+    operators.push_back(pred.operator_name);
+    left_names.push_back(pred.lhs);
+    right_names.push_back(pred.rhs);
+  }
+  // rows with a NULL key are skipped a bitmap word at a time
+  frame::Validity left_valid = ValidRows(left, left_names);
+  frame::Validity right_valid = ValidRows(right, right_names);
+
+  // blocks of left rows joined in parallel, concatenated in order
+  const size_t kBlockRows = 256;
+  size_t num_blocks = (left.num_rows() + kBlockRows - 1) / kBlockRows;
+  std::vector<std::vector<std::tuple<int, int>>> block_results(num_blocks);
+  frame::parallel_for(0, num_blocks, 1, [&](size_t lo, size_t hi) {
+    size_t end = std::min(left.num_rows(), hi * kBlockRows);
+    ForEachValid(left_valid, lo * kBlockRows, end, [&](size_t l) {
+      auto left_row = left.row(l);
+      auto &result = block_results[l / kBlockRows];
+      ForEachValid(right_valid, 0, right.num_rows(), [&](size_t r) {
+        auto right_row = right.row(r);
+        bool matching = true;
+        for (size_t p = 0; p < operators.size(); ++p) {
+          if (!Compare(operators[p], left_row[left_columns[p]],
+                       right_row[right_columns[p]])) {
+            matching = false;
+            break;
+          }
         }
-      }
-      if (matching) {
-        // TODO: add id in read_csv
-        //        assert(left.col_index("row_index") == 0);
-        //        assert(right.col_index("row_index") == 0);
-        result.emplace_back(left_row[0],
-                            right_row[0]); // get id from column row_index
-      }
-    }
+        if (matching) {
+          // TODO: add id in read_csv
+          //        assert(left.col_index("row_index") == 0);
+          //        assert(right.col_index("row_index") == 0);
+          result.emplace_back(left_row[0],
+                              right_row[0]); // get id from column row_index
+        }
+      });
+    });
+  });
+  std::vector<std::tuple<int, int>> result;
+  for (const auto &block : block_results) {
+    result.insert(result.end(), block.begin(), block.end());
   }
   return result;
 }
 
+// ids (first column) of the build side of HashJoin; NULL ids never match
+using HashTable = std::unordered_map<int, RowCursor>;
+
+HashTable HashBuild(const DataFrameView &left) {
+  const frame::Validity &left_valid = left.get_column(0).get_validity();
+  HashTable hashMap;
+  hashMap.reserve(left.num_rows());
+  ForEachValid(left_valid, 0, left.num_rows(), [&](size_t l) {
+    auto left_row = left.row(l);
+    hashMap.insert_or_assign(left_row[0], left_row);
+  });
+  return hashMap;
+}
+
+// emit(left id, right id) for every row of right whose id is in hashMap
+template <typename Emit>
+void HashProbe(const HashTable &hashMap, const DataFrameView &right,
+               Emit &&emit) {
+  const frame::Validity &right_valid = right.get_column(0).get_validity();
+  ForEachValid(right_valid, 0, right.num_rows(), [&](size_t r) {
+    auto rhs_id = right.row(r)[0];
+    auto match = hashMap.find(rhs_id);
+    if (match != hashMap.end()) {
+      emit(match->second[0], rhs_id);
+    }
+  });
+}
+
 // implement a hash-join algorithm for two tables
 // TODO: improve api... this algorithm assumes that the first column is the id
-std::vector<std::tuple<int, int>> HashJoin(const DataFrame &left, // should be a ColumnArray??
-                                           const DataFrame &right,
+std::vector<std::tuple<int, int>> HashJoin(const DataFrameView &left, // should be a ColumnArray??
+                                           const DataFrameView &right,
                                            const std::vector<Predicate> &preds,
                                            int trace = 0) {
-  std::unordered_map<int, RowArray> hashMap;
-  for (size_t i = 0; i < left.num_rows(); i++) {
-    const RowArray &left_row = left.get_row(i);
-    auto lhs_id = left_row[0];
-    hashMap[lhs_id] = left_row;
-  }
+  HashTable hashMap = HashBuild(left);
   std::vector<std::tuple<int, int>> result;
-  for (size_t i = 0; i < right.num_rows(); i++) {
-    const RowArray &right_row = right.get_row(i);
-    auto rhs_id = right_row[0];
-    if (hashMap.find(rhs_id) != hashMap.end()) {
-      result.emplace_back(hashMap[rhs_id][0], rhs_id);
-    }
-  }
+  HashProbe(hashMap, right,
+            [&](int lhs_id, int rhs_id) { result.emplace_back(lhs_id, rhs_id); });
   return result;
 }
 
-std::vector<std::pair<int, int>> IESelfJoin(const DataFrame &T,
-                                            const std::vector<Predicate> &preds,
-                                            int trace = 0) {
-  auto op1 = preds[0].condition();
+// Shape of a self-join predicate pair when the two tuples are swapped.
+enum kSymmetry {
+  kAsymmetric,    // (r, s) and (s, r) can both qualify, e.g. ties on <=, >=
+  kAntiSymmetric, // (r, s) qualifies => (s, r) does not, e.g. < with >
+  kSymmetric,     // (r, s) qualifies <=> (s, r) qualifies
+};
+
+kSymmetry DetectSymmetry(const std::vector<Predicate> &preds) {
+  auto op_name1 = preds[0].operator_name;
+  auto op_name2 = preds[1].operator_name;
+  // = and != are symmetric themselves, neither shape below holds for them
+  if (!IsOrdering(op_name1) || !IsOrdering(op_name2)) {
+    return kAsymmetric;
+  }
+  // X op1 X and X Flip(op1) X: swapping r and s swaps the two predicates
+  if (preds[0].lhs == preds[1].lhs && op_name2 == FlipOperator(op_name1)) {
+    return kSymmetric;
+  }
+  if (IsStrict(op_name1) || IsStrict(op_name2)) {
+    return kAntiSymmetric;
+  }
+  return kAsymmetric;
+}
+
+// Self join over a symmetric predicate pair: either nothing qualifies (strict
+// operators) or the pair reduces to X = X, so the result is every ordered pair
+// inside a run of equal keys and no bit-array scan is needed.
+std::vector<std::pair<int, int>>
+SymmetricSelfJoin(const DataFrameView &T, const std::vector<Predicate> &preds) {
+  std::vector<std::pair<int, int>> join_result;
+  if (IsStrict(preds[0].operator_name)) {
+    return join_result;
+  }
   auto X = preds[0].lhs;
+  DataFrame L = ArrayOf(T, {X}).sort_by(X);
+  ColumnArray L1 = ExtractColumn(L, 1);
+  ColumnArray Li = ExtractColumn(L, 0);
+  int n = L.num_rows();
+  int start = 0;
+  while (start < n) {
+    int end = start + 1;
+    while (end < n && L1[end] == L1[start]) {
+      end += 1;
+    }
+    for (int a = start; a < end; ++a) {
+      for (int b = start; b < end; ++b) {
+        join_result.emplace_back(Li[a], Li[b]);
+      }
+    }
+    start = end;
+  }
+  return join_result;
+}
 
-  auto op2 = preds[1].condition();
+// Sorted arrays of the IESelfJoin algorithm, shared by its output modes.
+struct IESelfJoinIndex {
+  int n;
+  std::function<bool(DataType, DataType)> op2;
+  ColumnArray L1;      // X sorted w.r.t. op1
+  ColumnArray L1y;     // Y in L1 order
+  ColumnArray L2;      // Y sorted w.r.t. op2
+  ColumnArray Li;      // row ids in L1 order
+  ColumnArray P;       // permutation array of L2 w.r.t. L1
+  std::vector<int> O1; // first candidate position of every L1 entry
+  std::vector<int> R2; // end of the run of equal keys of every L2 entry
+};
+
+IESelfJoinIndex PrepareIESelfJoin(const DataFrameView &T,
+                                  const std::vector<Predicate> &preds,
+                                  int trace = 0) {
+  auto X = preds[0].lhs;
   auto Y = preds[1].lhs;
-  int n = T.num_rows();
   auto op_name1 = preds[0].operator_name;
   auto op_name2 = preds[1].operator_name;
 
   // 1. let L1 (resp. L2) be the array of column X (resp. Y )
-  DataFrame L = ArrayOf(T, {X, Y});
+  DataFrameView LX = ArrayOf(T, {X, Y});
 
   // L:  [[0, 100, 6], [1, 140, 11], [2, 80, 10], [3, 90, 5]]
   if (trace)
-    PrintArray("L", L);
+    PrintArray("L", LX.to_dataframe());
 
   // 2. if (op1 ∈ {>, ≥}) sort L1 in descending order
   // 3.  else if (op1 ∈ {<, ≤}) sort L1 in ascending order
   bool descending1 = (op_name1 == kOperator::kGreater) ||
                      (op_name1 == kOperator::kGreaterEqual);
-  L = L.sort_by(X, descending1);
+  bool descending2 =
+      (op_name2 == kOperator::kLess) || (op_name2 == kOperator::kLessEqual);
+  // ties in X in the order of the Y sort, so a run of equal L1 keys maps to
+  // increasing positions of L2
+  DataFrame L = LX.sort_by({{X, descending1}, {Y, descending2}});
   if (trace)
     PrintArray("sortLx", L);
   ColumnArray L1 = ExtractColumn(L, 1);
+  ColumnArray L1y = ExtractColumn(L, 2);
 
   Mark(L);
   if (trace)
     PrintArray("L", L);
 
   assert(L.col_index("row_index") == 0);
-  auto Li = ExtractColumn(L, 0);
+  ColumnArray Li = ExtractColumn(L, 0);
 
   // 4. if (op2 ∈ {>, ≥}) sort L2 in ascending order
   // 5.  else if (op2 ∈ {<, ≤}) sort L2 in descending order
-  bool descending2 =
-      (op_name2 == kOperator::kLess) || (op_name2 == kOperator::kLessEqual);
-
   L = L.sort_by(Y, descending2);
   if (trace)
     PrintArray("sortLY", L);
@@ -215,64 +469,142 @@ std::vector<std::pair<int, int>> IESelfJoin(const DataFrame &T,
   // 6. compute the permutation array P of L2 w.r.t. L1
   ColumnArray P = ExtractColumn(L, 3);
 
-  // 7. initialize bit-array B (|B| = n), and set all bits to 0
-  boost::dynamic_bitset<> B(n);
-  //
-  //  // 8. initialize join result as an empty list for tuple pairs
-  std::vector<std::pair<int, int>> join_result;
+  // 9.  if (op1 ∈ {≤,≥} and op2 ∈ {≤,≥}) eqOff = 0
+  // 10. else eqOff = 1
+  // No, because there could be more than one equal value: start at the
+  // beginning (non-strict) or past the end (strict) of the run of L1[pos].
+  std::vector<int> O1 = RunBounds(L1, IsStrict(op_name1));
+  // end of each run of L2, so the sweep compares once per distinct key
+  std::vector<int> R2 = RunBounds(L2, true);
+  return IESelfJoinIndex{.n = static_cast<int>(L.num_rows()),
+                         .op2 = preds[1].condition(),
+                         .L1 = std::move(L1),
+                         .L1y = std::move(L1y),
+                         .L2 = std::move(L2),
+                         .Li = std::move(Li),
+                         .P = std::move(P),
+                         .O1 = std::move(O1),
+                         .R2 = std::move(R2)};
+}
 
-  std::cout << "how many rows: " << n << std::endl;
+// Lines 11-16 of IESelfJoin: for every row i of L2, set the bits of all its
+// op2 matches (calling on_set(p) for each new bit p), then call
+// on_probe(pos, off1) where every match of L1[pos] is a set bit >= off1.
+template <typename BitArray, typename OnSet, typename OnProbe>
+void IESelfJoinSweep(const IESelfJoinIndex &index, BitArray &B, OnSet &&on_set,
+                     OnProbe &&on_probe) {
+  const auto &L2 = index.L2;
+  const auto &P = index.P;
+  const auto &R2 = index.R2;
+  int n = index.n;
   // 11. for(i←1 to n) do
   int off2 = 0;
-  boost::dynamic_bitset<> one_bit(1, 1);
-
   for (int i = 0; i < n; ++i) {
     // 16. B[pos] ← 1
     // This has to come first or we will never join the first tuple.
     while (off2 < n) {
-      if (!op2(L2[i], L2[off2])) {
+      if (!index.op2(L2[i], L2[off2])) {
         break;
       }
-      B.set(P[off2], true);
-      off2 += 1;
-    }
-    if (trace) {
-      //   std::cerr << "B: " << i << " " << B.to_ulong() << std::endl;
+      for (int end = R2[off2]; off2 < end; ++off2) {
+        B.set(P[off2], true);
+        on_set(P[off2]);
+      }
     }
 
     // 12. pos ← P[i]
     int pos = P[i];
+    on_probe(pos, index.O1[pos]);
+  }
+}
 
-    // 9.  if (op1 ∈ {≤,≥} and op2 ∈ {≤,≥}) eqOff = 0
-    // 10. else eqOff = 1
-    // No, because there could be more than one equal value.
-    // Scan the neighborhood instead
-    int off1 = pos;
-    while (op1(L1[off1], L1[pos]) && off1 > 0) {
-      off1 -= 1;
-    }
-    while (off1 < n && !op1(L1[pos], L1[off1])) {
-      off1 += 1;
+// The sweep orders the rows on both keys, which != does not: X != X is the
+// disjoint union of X < X and X > X. The two halves of preds with its first
+// != split that way, or nothing when it has none.
+std::vector<std::vector<Predicate>>
+SplitNotEqual(const std::vector<Predicate> &preds) {
+  for (size_t k = 0; k < preds.size(); ++k) {
+    if (preds[k].operator_name == kNotEqual) {
+      std::vector<std::vector<Predicate>> halves(2, preds);
+      halves[0][k].operator_name = kLess;
+      halves[1][k].operator_name = kGreater;
+      return halves;
     }
+  }
+  return {};
+}
 
-    // 13. for (j ← pos+eqOff to n) do
-    while (true) {
-      // 14. if B[j] = 1 then
-      int j = B.find_next(off1 - 1);
-
-      if (j >= n or j == -1) {
-        break;
-      }
-
-      // 15. add tuples w.r.t. (L1[j], L1[i]) to join result
-      if (trace) {
-        std::cerr << "j,i': " << j << "," << i << std::endl;
+// mirrored: also emit (s, r) for every discovered (r, s), i.e. the union of
+// the query and its mirror (both operators flipped), from a single sweep.
+template <typename BitArray = boost::dynamic_bitset<>>
+std::vector<std::pair<int, int>> IESelfJoin(const DataFrameView &T,
+                                            const std::vector<Predicate> &preds,
+                                            int trace = 0,
+                                            bool mirrored = false) {
+  auto halves = SplitNotEqual(preds);
+  if (!halves.empty()) {
+    std::vector<std::pair<int, int>> join_result;
+    for (const auto &half : halves) {
+      auto part = IESelfJoin<BitArray>(T, half, trace);
+      join_result.insert(join_result.end(), part.begin(), part.end());
+    }
+    if (mirrored) {
+      size_t size = join_result.size();
+      for (size_t i = 0; i < size; ++i) {
+        join_result.emplace_back(join_result[i].second, join_result[i].first);
       }
-      auto t = std::make_pair(Li[pos], Li[j]);
-      join_result.emplace_back(t);
-      off1 = j + 1;
+      std::sort(join_result.begin(), join_result.end());
+      join_result.erase(std::unique(join_result.begin(), join_result.end()),
+                        join_result.end());
     }
+    return join_result;
+  }
+  kSymmetry symmetry = DetectSymmetry(preds);
+  if (symmetry == kSymmetric) {
+    // the query already is its own mirror
+    return SymmetricSelfJoin(T, preds);
   }
+  IESelfJoinIndex index = PrepareIESelfJoin(T, preds, trace);
+  const auto &L1 = index.L1;
+  const auto &L1y = index.L1y;
+  const auto &Li = index.Li;
+  int n = index.n;
+
+  // 7. initialize bit-array B (|B| = n), and set all bits to 0
+  BitArray B(n);
+  //
+  //  // 8. initialize join result as an empty list for tuple pairs
+  std::vector<std::pair<int, int>> join_result;
+
+  if (trace) {
+    std::cout << "how many rows: " << n << std::endl;
+  }
+  IESelfJoinSweep(
+      index, B, [](int) {},
+      [&](int pos, int off1) {
+        // 13. for (j ← pos+eqOff to n) do
+        while (true) {
+          // 14. if B[j] = 1 then
+          int j = FindFrom(B, off1);
+
+          if (j >= n or j == -1) {
+            break;
+          }
+
+          // 15. add tuples w.r.t. (L1[j], L1[i]) to join result
+          if (trace) {
+            std::cerr << "j,pos: " << j << "," << pos << std::endl;
+          }
+          auto t = std::make_pair(Li[pos], Li[j]);
+          join_result.emplace_back(t);
+          // (s, r) qualifies by itself only on ties of both non-strict keys
+          if (mirrored && (symmetry == kAntiSymmetric || L1[pos] != L1[j] ||
+                           L1y[pos] != L1y[j])) {
+            join_result.emplace_back(Li[j], Li[pos]);
+          }
+          off1 = j + 1;
+        }
+      });
   return join_result;
 }
 
@@ -292,100 +624,185 @@ std::vector<int> OffsetArray(const ColumnArray &L, const ColumnArray &Lr,
   return O;
 }
 
-std::vector<std::pair<int, int>> IEJoin(const DataFrame &T, const DataFrame &Tr,
-                                        const std::vector<Predicate> &preds,
-                                        int trace = 0) {
-  auto op1 = preds[0].condition();
-  auto X = preds[0].lhs;
-  auto Xr = preds[0].rhs;
+// Sorted arrays of the IEJoin algorithm, shared by its output modes.
+struct IEJoinIndex {
+  int m;
+  int n;
+  std::function<bool(DataType, DataType)> op2;
+  ColumnArray L2;       // left Y sorted w.r.t. op2
+  ColumnArray L_2;      // right Y sorted w.r.t. op2
+  ColumnArray Li;       // left row ids in L2 order
+  ColumnArray Lk;       // right row ids in Lr1 order
+  ColumnArray P;        // permutation array of L2 w.r.t. L1
+  ColumnArray Pr;       // permutation array of L_2 w.r.t. Lr1
+  std::vector<int> O1;  // offset of every L1 entry into Lr1
+  // end of the run of equal keys of every L_2 entry
+  std::shared_ptr<const std::vector<int>> R_2;
+};
 
-  auto op2 = preds[1].condition();
-  auto Y = preds[1].lhs;
+// Right side of the IEJoin arrays, sorted once and shared by the indexes of
+// any number of left frames, such as the batches of a stream.
+struct IEJoinInner {
+  int n;
+  ColumnArray Lr1; // right X sorted w.r.t. op1
+  ColumnArray L_2; // right Y sorted w.r.t. op2
+  ColumnArray Lk;  // right row ids in Lr1 order
+  ColumnArray Pr;  // permutation array of L_2 w.r.t. Lr1
+  std::shared_ptr<const std::vector<int>> R_2; // see IEJoinIndex
+};
+
+IEJoinInner PrepareIEJoinInner(const DataFrameView &Tr,
+                               const std::vector<Predicate> &preds,
+                               int trace = 0) {
+  auto Xr = preds[0].rhs;
   auto Yr = preds[1].rhs;
+  auto op_name1 = preds[0].operator_name;
+  auto op_name2 = preds[1].operator_name;
 
-  int m = T.num_rows();
-  int n = Tr.num_rows();
+  bool descending1 = (op_name1 == kOperator::kGreater) ||
+                     (op_name1 == kOperator::kGreaterEqual);
+  DataFrame Lr = ArrayOf(Tr, {Xr, Yr}).sort_by(Xr, descending1);
+  ColumnArray Lr1 = ExtractColumn(Lr, 1);
+  Mark(Lr);
+  // rows with NULL keys are not in Lr
+  int n = Lr.num_rows();
+  if (trace)
+    PrintArray("Lr1:", Lr1);
+  ColumnArray Lk = ExtractColumn(Lr, 0);
 
+  bool descending2 =
+      (op_name2 == kOperator::kLess || op_name2 == kOperator::kLessEqual);
+  Lr = Lr.sort_by(Yr, descending2);
+  ColumnArray L_2 = ExtractColumn(Lr, 2);
+  ColumnArray Pr = ExtractColumn(Lr, 3);
   if (trace) {
-    std::cerr << "n:" << n << "|"
-              << "m:" << m << std::endl;
+    PrintArray("L_2:", L_2);
+    PrintArray("Pr:", Pr);
   }
 
+  // end of each run of L_2, so the sweep compares once per distinct key
+  auto R_2 = std::make_shared<const std::vector<int>>(RunBounds(L_2, true));
+  return IEJoinInner{.n = n,
+                     .Lr1 = std::move(Lr1),
+                     .L_2 = std::move(L_2),
+                     .Lk = std::move(Lk),
+                     .Pr = std::move(Pr),
+                     .R_2 = std::move(R_2)};
+}
+
+IEJoinIndex PrepareIEJoin(const DataFrameView &T, const IEJoinInner &inner,
+                          const std::vector<Predicate> &preds, int trace = 0) {
+  auto op1 = preds[0].condition();
+  auto X = preds[0].lhs;
+  auto Y = preds[1].lhs;
+
   auto op_name1 = preds[0].operator_name;
   auto op_name2 = preds[1].operator_name;
 
   /////////////////////////////
-  DataFrame L = ArrayOf(T, {X, Y});
-  DataFrame Lr = ArrayOf(Tr, {Xr, Yr});
   bool descending1 = (op_name1 == kOperator::kGreater) ||
                      (op_name1 == kOperator::kGreaterEqual);
-  L = L.sort_by(X, descending1);
+  DataFrame L = ArrayOf(T, {X, Y}).sort_by(X, descending1);
   ColumnArray L1 = ExtractColumn(L, 1);
 
   if (trace)
     PrintArray("L1:", L1);
 
   Mark(L);
-  ////////////////////////////////
-  Lr = Lr.sort_by(Xr, descending1);
-  ColumnArray Lr1 = ExtractColumn(Lr, 1);
-  Mark(Lr);
 
-  if (trace)
-    PrintArray("Lr1:", Lr1);
+  // rows with NULL keys are not in L
+  int m = L.num_rows();
+  if (trace) {
+    std::cerr << "n:" << inner.n << "|"
+              << "m:" << m << std::endl;
+  }
 
   ////////////////////////////////
   bool descending2 =
       (op_name2 == kOperator::kLess || op_name2 == kOperator::kLessEqual);
   L = L.sort_by(Y, descending2);
-  auto L2 = ExtractColumn(L, 2);
+  ColumnArray L2 = ExtractColumn(L, 2);
   if (trace)
     PrintArray("L2:", L2);
 
   ////////////////////////////////
   assert(L.col_index("row_index") == 0);
-  auto Li = ExtractColumn(L, 0);
-  auto Lk = ExtractColumn(Lr, 0);
-
-  Lr = Lr.sort_by(Yr, descending2);
-  auto L_2 = ExtractColumn(Lr, 2);
-  if (trace)
-    PrintArray("L_2:", L_2);
+  ColumnArray Li = ExtractColumn(L, 0);
 
-  auto P = ExtractColumn(L, 3);
-  auto Pr = ExtractColumn(Lr, 3);
+  ColumnArray P = ExtractColumn(L, 3);
   if (trace) {
     PrintArray("P:", P);
-    PrintArray("Pr:", Pr);
   }
 
-  auto O1 = OffsetArray(L1, Lr1, op1);
+  auto O1 = OffsetArray(L1, inner.Lr1, op1);
   if (trace) {
     PrintArray("O1:", O1);
   }
 
-  // 7. initialize bit-array B (|B| = n), and set all bits to 0
-  boost::dynamic_bitset<> B(n);
-  //
-  //  // 8. initialize join result as an empty list for tuple pairs
-  std::vector<std::pair<int, int>> join_result;
+  return IEJoinIndex{.m = m,
+                     .n = inner.n,
+                     .op2 = preds[1].condition(),
+                     .L2 = std::move(L2),
+                     .L_2 = inner.L_2,
+                     .Li = std::move(Li),
+                     .Lk = inner.Lk,
+                     .P = std::move(P),
+                     .Pr = inner.Pr,
+                     .O1 = std::move(O1),
+                     .R_2 = inner.R_2};
+}
 
-  boost::dynamic_bitset<> one_bit(1, 1);
+IEJoinIndex PrepareIEJoin(const DataFrameView &T, const DataFrameView &Tr,
+                          const std::vector<Predicate> &preds, int trace = 0) {
+  return PrepareIEJoin(T, PrepareIEJoinInner(Tr, preds, trace), preds, trace);
+}
 
+// For every row i of L2, set the bits of all its op2 matches in Tr (calling
+// on_set(p) for each new bit p), then call on_probe(i, off1) where every
+// match of Li[i] is a set bit >= off1.
+template <typename BitArray, typename OnSet, typename OnProbe>
+void IEJoinSweep(const IEJoinIndex &index, BitArray &B, OnSet &&on_set,
+                 OnProbe &&on_probe) {
+  const auto &L2 = index.L2;
+  const auto &L_2 = index.L_2;
+  const auto &Pr = index.Pr;
+  const auto &R_2 = *index.R_2;
+  int n = index.n;
   int off2 = 0;
-  for (int i = 0; i < m; ++i) {
+  for (int i = 0; i < index.m; ++i) {
     while (off2 < n) {
-      if (not op2(L2[i], L_2[off2])) {
+      if (not index.op2(L2[i], L_2[off2])) {
         break;
       }
-      B.set(Pr[off2], true);
-      off2 += 1;
+      for (int end = R_2[off2]; off2 < end; ++off2) {
+        B.set(Pr[off2], true);
+        on_set(Pr[off2]);
+      }
     }
-    int pos = P[i];
-    int off1 = O1[pos];
+    int pos = index.P[i];
+    on_probe(i, index.O1[pos]);
+  }
+}
+
+template <typename BitArray = boost::dynamic_bitset<>>
+std::vector<std::pair<int, int>> IEJoin(const DataFrameView &T,
+                                        const DataFrameView &Tr,
+                                        const std::vector<Predicate> &preds,
+                                        int trace = 0) {
+  IEJoinIndex index = PrepareIEJoin(T, Tr, preds, trace);
+  const auto &Li = index.Li;
+  const auto &Lk = index.Lk;
+  int n = index.n;
 
+  // 7. initialize bit-array B (|B| = n), and set all bits to 0
+  BitArray B(n);
+  //
+  //  // 8. initialize join result as an empty list for tuple pairs
+  std::vector<std::pair<int, int>> join_result;
+
+  IEJoinSweep(index, B, [](int) {}, [&](int i, int off1) {
     while (true) {
-      int k = B.find_next(off1 - 1);
+      int k = FindFrom(B, off1);
 
       if (k >= n or k == -1) {
         break;
@@ -394,16 +811,621 @@ std::vector<std::pair<int, int>> IEJoin(const DataFrame &T, const DataFrame &Tr,
       join_result.emplace_back(t);
       off1 = k + 1;
     }
-  }
+  });
   return join_result;
 }
+
+using JoinSink = std::function<void(const std::vector<std::pair<int, int>> &)>;
+
+// pairs handed to the sink of a streaming join per call
+const size_t kStreamSinkBatch = size_t(1) << 16;
+
+// HashJoin with the right (probe) side read batch by batch: the table of
+// left is built once and only one batch of right is in memory at a time.
+// Like HashJoin it matches the ids (first columns) of the two sides, so it
+// takes no predicates. The (left id, right id) pairs go to sink.
+void StreamHashJoin(const DataFrameView &left,
+                    frame::BatchReader<DataType> &right, const JoinSink &sink) {
+  HashTable hashMap = HashBuild(left);
+  DataFrameView batch;
+  std::vector<std::pair<int, int>> pairs;
+  while (right.next(batch)) {
+    HashProbe(hashMap, batch, [&](int lhs_id, int rhs_id) {
+      pairs.emplace_back(lhs_id, rhs_id);
+      if (pairs.size() == kStreamSinkBatch) {
+        sink(pairs);
+        pairs.clear();
+      }
+    });
+  }
+  if (!pairs.empty()) {
+    sink(pairs);
+  }
+}
+
+// IEJoin with the left (outer) side read batch by batch against right,
+// whose arrays are sorted once: only one batch of left is in memory at a
+// time. The pairs of rows of the left input and of right go to sink.
+template <typename BitArray = boost::dynamic_bitset<>>
+void StreamIEJoin(frame::BatchReader<DataType> &left, const DataFrameView &right,
+                  const std::vector<Predicate> &preds, const JoinSink &sink,
+                  int trace = 0) {
+  IEJoinInner inner = PrepareIEJoinInner(right, preds, trace);
+  DataFrameView batch;
+  std::vector<std::pair<int, int>> pairs;
+  while (left.next(batch)) {
+    IEJoinIndex index = PrepareIEJoin(batch, inner, preds, trace);
+    const auto &Li = index.Li;
+    const auto &Lk = index.Lk;
+    int n = index.n;
+    int offset = left.batch_offset();
+    BitArray B(n);
+    IEJoinSweep(index, B, [](int) {}, [&](int i, int off1) {
+      while (true) {
+        int k = FindFrom(B, off1);
+        if (k >= n or k == -1) {
+          break;
+        }
+        pairs.emplace_back(offset + Li[i], Lk[k]);
+        if (pairs.size() == kStreamSinkBatch) {
+          sink(pairs);
+          pairs.clear();
+        }
+        off1 = k + 1;
+      }
+    });
+  }
+  if (!pairs.empty()) {
+    sink(pairs);
+  }
+}
+
+// Order-preserving int32 codes of column lhs of T and column rhs of Tr, over
+// the union of their values. Mixed numeric types compare in their common
+// type (int32 with double as double, ...); strings compare only with strings,
+// by their dictionary codes as they are when the columns share a dictionary.
+inline std::pair<std::vector<DataType>, std::vector<DataType>>
+EncodeColumns(const frame::TypedDataframe &T, const std::string &lhs,
+              const frame::TypedDataframe &Tr, const std::string &rhs) {
+  return std::visit(
+      [&](const auto &left, const auto &right)
+          -> std::pair<std::vector<DataType>, std::vector<DataType>> {
+        using Left = typename std::decay_t<decltype(left)>::value_type;
+        using Right = typename std::decay_t<decltype(right)>::value_type;
+        if constexpr (std::is_same_v<Left, std::string_view> !=
+                      std::is_same_v<Right, std::string_view>) {
+          throw std::invalid_argument("cannot compare " + lhs + " with " + rhs);
+        } else {
+          return frame::TypedDataframe::rank_encode(left, right);
+        }
+      },
+      T.get_column(T.col_index(lhs)).values,
+      Tr.get_column(Tr.col_index(rhs)).values);
+}
+
+// Codes of a column a and a partner column, over their union, seen from a:
+// every code falls in the gap before the next value of a, or is one.
+struct CodeGaps {
+  std::vector<bool> anchor; // the code is a value of a
+  std::vector<int> gap;     // gap of the code, the one an anchor ends
+  std::vector<int> rank;    // rank of a non-anchor code within its gap
+  std::vector<int> sizes;   // non-anchor codes per gap
+
+  CodeGaps(const std::vector<DataType> &a, const std::vector<DataType> &other) {
+    DataType size = 0;
+    for (DataType code : a) {
+      size = std::max(size, code + 1);
+    }
+    for (DataType code : other) {
+      size = std::max(size, code + 1);
+    }
+    anchor.assign(size, false);
+    for (DataType code : a) {
+      anchor[code] = true;
+    }
+    gap.assign(size, 0);
+    rank.assign(size, 0);
+    sizes.assign(1, 0);
+    for (DataType code = 0; code < size; ++code) {
+      gap[code] = sizes.size() - 1;
+      if (anchor[code]) {
+        sizes.push_back(0);
+      } else {
+        rank[code] = sizes.back()++;
+      }
+    }
+  }
+};
+
+// One code space for a column a compared with two others, b and c, from the
+// codes of (a, b) over their union and of (a, c) over theirs: the result
+// orders a against b and a against c like the values. Codes between two
+// consecutive values of a are laid out as those of b, then those of c; b and
+// c are never compared with each other, so their relative order is free.
+inline std::tuple<std::vector<DataType>, std::vector<DataType>,
+                  std::vector<DataType>>
+MergeCodeSpaces(const std::vector<DataType> &ab_a,
+                const std::vector<DataType> &ab_b,
+                const std::vector<DataType> &ac_a,
+                const std::vector<DataType> &ac_c) {
+  CodeGaps bs(ab_a, ab_b), cs(ac_a, ac_c);
+  // the anchors are the same values of a in both spaces, so the gaps match
+  std::vector<DataType> start(bs.sizes.size(), 0);
+  for (size_t g = 1; g < start.size(); ++g) {
+    start[g] = start[g - 1] + bs.sizes[g - 1] + cs.sizes[g - 1] + 1;
+  }
+  auto anchor_code = [&](int gap) {
+    return start[gap] + bs.sizes[gap] + cs.sizes[gap];
+  };
+  std::vector<DataType> a(ab_a.size()), b(ab_b.size()), c(ac_c.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    a[i] = anchor_code(bs.gap[ab_a[i]]);
+  }
+  for (size_t i = 0; i < b.size(); ++i) {
+    DataType code = ab_b[i];
+    b[i] = bs.anchor[code] ? anchor_code(bs.gap[code])
+                           : start[bs.gap[code]] + bs.rank[code];
+  }
+  for (size_t i = 0; i < c.size(); ++i) {
+    DataType code = ac_c[i];
+    c[i] = cs.anchor[code]
+               ? anchor_code(cs.gap[code])
+               : start[cs.gap[code]] + bs.sizes[cs.gap[code]] + cs.rank[code];
+  }
+  return {std::move(a), std::move(b), std::move(c)};
+}
+
+// int frame of the given code columns of source, in the layout the joins
+// expect; the codes keep the NULLs of their column
+inline DataFrame
+CodeFrame(const frame::TypedDataframe &source,
+          std::vector<std::pair<std::string, std::vector<DataType>>> columns) {
+  DataFrame frame = DataFrame::create_empty_dataframe(source.num_rows());
+  frame.create_row_index();
+  for (auto &[name, codes] : columns) {
+    frame.insert(name, frame::ColumnVector<DataType>(codes.begin(), codes.end()));
+    frame.set_validity(name,
+                       source.get_column(source.col_index(name)).validity);
+  }
+  return frame;
+}
+
+// IEJoin of typed frames. Every predicate column pair is rank-encoded into
+// int32 codes that order like the values, so the int32 kernel joins columns
+// of any type; row ids are those of T and Tr.
+template <typename BitArray = boost::dynamic_bitset<>>
+std::vector<std::pair<int, int>> TypedIEJoin(const frame::TypedDataframe &T,
+                                             const frame::TypedDataframe &Tr,
+                                             const std::vector<Predicate> &preds,
+                                             int trace = 0) {
+  std::vector<std::pair<std::string, std::vector<DataType>>> left, right;
+  for (const auto &pred : preds) {
+    auto [lhs, rhs] = EncodeColumns(T, pred.lhs, Tr, pred.rhs);
+    left.emplace_back(pred.lhs, std::move(lhs));
+    right.emplace_back(pred.rhs, std::move(rhs));
+  }
+  // A column in both predicates needs one code, comparable with both of its
+  // partners. Paired with the same column twice, both encodings are alike.
+  bool shared_lhs = preds[1].lhs == preds[0].lhs;
+  bool shared_rhs = preds[1].rhs == preds[0].rhs;
+  if (shared_lhs && !shared_rhs) {
+    auto [a, b, c] = MergeCodeSpaces(left[0].second, right[0].second,
+                                     left[1].second, right[1].second);
+    left[0].second = std::move(a);
+    right[0].second = std::move(b);
+    right[1].second = std::move(c);
+  } else if (shared_rhs && !shared_lhs) {
+    auto [a, b, c] = MergeCodeSpaces(right[0].second, left[0].second,
+                                     right[1].second, left[1].second);
+    right[0].second = std::move(a);
+    left[0].second = std::move(b);
+    left[1].second = std::move(c);
+  }
+  if (shared_lhs) {
+    left.pop_back();
+  }
+  if (shared_rhs) {
+    right.pop_back();
+  }
+  return IEJoin<BitArray>(CodeFrame(T, std::move(left)),
+                          CodeFrame(Tr, std::move(right)), preds, trace);
+}
+
+// Equi-join of typed frames on pred (kEqual). Both columns are encoded into
+// dense codes as in TypedIEJoin, the right rows are bucketed by code with a
+// counting sort and every left row is matched against the bucket of its
+// code; NULL keys match nothing. Returns pairs of row ids of T and Tr.
+inline std::vector<std::pair<int, int>>
+TypedEqualJoin(const frame::TypedDataframe &T, const frame::TypedDataframe &Tr,
+               const Predicate &pred) {
+  if (pred.operator_name != kEqual) {
+    throw std::invalid_argument("TypedEqualJoin needs an equality predicate");
+  }
+  auto [left, right] = EncodeColumns(T, pred.lhs, Tr, pred.rhs);
+  const auto &left_valid = T.get_column(T.col_index(pred.lhs)).validity;
+  const auto &right_valid = Tr.get_column(Tr.col_index(pred.rhs)).validity;
+  DataType num_codes = 0;
+  for (DataType code : left) {
+    num_codes = std::max(num_codes, code + 1);
+  }
+  for (DataType code : right) {
+    num_codes = std::max(num_codes, code + 1);
+  }
+  // right rows of code c are rows[start[c]..start[c + 1])
+  std::vector<int> start(num_codes + 1, 0);
+  ForEachValid(right_valid, 0, right.size(),
+               [&](size_t r) { start[right[r] + 1]++; });
+  std::partial_sum(start.begin(), start.end(), start.begin());
+  std::vector<int> rows(start.back());
+  std::vector<int> next(start.begin(), start.end() - 1);
+  ForEachValid(right_valid, 0, right.size(),
+               [&](size_t r) { rows[next[right[r]]++] = r; });
+
+  std::vector<std::pair<int, int>> result;
+  ForEachValid(left_valid, 0, left.size(), [&](size_t l) {
+    for (int k = start[left[l]]; k < start[left[l] + 1]; ++k) {
+      result.emplace_back(l, rows[k]);
+    }
+  });
+  return result;
+}
+
+// IESelfJoin of a typed frame, through int32 codes as TypedIEJoin.
+template <typename BitArray = boost::dynamic_bitset<>>
+std::vector<std::pair<int, int>>
+TypedIESelfJoin(const frame::TypedDataframe &T,
+                const std::vector<Predicate> &preds, int trace = 0,
+                bool mirrored = false) {
+  std::vector<std::pair<std::string, std::vector<DataType>>> columns;
+  for (const auto &pred : preds) {
+    if (columns.empty() || columns[0].first != pred.lhs) {
+      columns.emplace_back(pred.lhs,
+                           EncodeColumns(T, pred.lhs, T, pred.lhs).first);
+    }
+  }
+  return IESelfJoin<BitArray>(CodeFrame(T, std::move(columns)), preds, trace,
+                              mirrored);
+}
+
+// A run of matches: left row id joined with right_ids[start..end) of its
+// RangeJoinResult, i.e. a run of consecutive set bits of B.
+struct JoinRun {
+  int left;
+  int start;
+  int end;
+};
+
+// Range-encoded join result. The right row ids are stored once, in the
+// permuted (L1) order of the bit-array, and every run of consecutive matches
+// costs one JoinRun however long it is. Iterating expands the pairs lazily.
+struct RangeJoinResult {
+  std::vector<int> right_ids;
+  std::vector<JoinRun> runs;
+
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<int, int>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type *;
+    using reference = value_type;
+
+    iterator(const RangeJoinResult *result, size_t run, int j)
+        : result(result), run(run), j(j) {}
+
+    value_type operator*() const {
+      return {result->runs[run].left, result->right_ids[j]};
+    }
+
+    iterator &operator++() {
+      if (++j >= result->runs[run].end && ++run < result->runs.size()) {
+        j = result->runs[run].start;
+      }
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator tmp = *this;
+      ++*this;
+      return tmp;
+    }
+
+    bool operator==(const iterator &other) const {
+      return run == other.run && (run == result->runs.size() || j == other.j);
+    }
+
+  private:
+    const RangeJoinResult *result;
+    size_t run;
+    int j;
+  };
+
+  iterator begin() const {
+    return iterator(this, 0, runs.empty() ? 0 : runs[0].start);
+  }
+
+  iterator end() const { return iterator(this, runs.size(), 0); }
+
+  size_t num_pairs() const {
+    size_t count = 0;
+    for (const auto &run : runs) {
+      count += run.end - run.start;
+    }
+    return count;
+  }
+
+  std::vector<std::pair<int, int>> expand() const {
+    std::vector<std::pair<int, int>> pairs;
+    pairs.reserve(num_pairs());
+    for (const auto &pair : *this) {
+      pairs.emplace_back(pair);
+    }
+    return pairs;
+  }
+};
+
+// Append the runs of set bits of B from off1 on to result. Z mirrors B with
+// every bit flipped, so the end of a run is the next set bit of Z.
+template <typename BitArray>
+void EmitRuns(const BitArray &B, const BitArray &Z, int n, int left, int off1,
+              RangeJoinResult &result) {
+  while (off1 < n) {
+    int start = FindFrom(B, off1);
+    if (start >= n or start == -1) {
+      break;
+    }
+    int end = FindFrom(Z, start);
+    if (end >= n or end == -1) {
+      end = n;
+    }
+    result.runs.push_back(JoinRun{left, start, end});
+    off1 = end;
+  }
+}
+
+// IESelfJoin emitting (Li[pos], start, end) runs instead of single pairs;
+// result.right_ids is Li. Same pairs as IESelfJoin(T, preds).
+template <typename BitArray = boost::dynamic_bitset<>>
+RangeJoinResult IESelfJoinRanges(const DataFrameView &T,
+                                 const std::vector<Predicate> &preds,
+                                 int trace = 0) {
+  RangeJoinResult result;
+  auto halves = SplitNotEqual(preds);
+  if (!halves.empty()) {
+    // the runs of each half, over its own right ids appended to the table
+    for (const auto &half : halves) {
+      RangeJoinResult part = IESelfJoinRanges<BitArray>(T, half, trace);
+      int offset = static_cast<int>(result.right_ids.size());
+      result.right_ids.insert(result.right_ids.end(), part.right_ids.begin(),
+                              part.right_ids.end());
+      for (const JoinRun &run : part.runs) {
+        result.runs.push_back(
+            JoinRun{run.left, offset + run.start, offset + run.end});
+      }
+    }
+    return result;
+  }
+  if (DetectSymmetry(preds) == kSymmetric) {
+    // every row matches exactly the run of its own key
+    if (IsStrict(preds[0].operator_name)) {
+      return result;
+    }
+    DataFrame L = ArrayOf(T, {preds[0].lhs}).sort_by(preds[0].lhs);
+    ColumnArray L1 = ExtractColumn(L, 1);
+    const ColumnArray &ids = L.get_column(0);
+    result.right_ids.assign(ids.begin(), ids.end());
+    std::vector<int> starts = RunBounds(L1, false);
+    std::vector<int> ends = RunBounds(L1, true);
+    for (size_t a = 0; a < L1.size(); ++a) {
+      result.runs.push_back(JoinRun{result.right_ids[a], starts[a], ends[a]});
+    }
+    return result;
+  }
+  IESelfJoinIndex index = PrepareIESelfJoin(T, preds, trace);
+  const auto &Li = index.Li;
+  int n = index.n;
+  result.right_ids.assign(Li.begin(), Li.end());
+
+  BitArray B(n);
+  BitArray Z(n);
+  Z.set();
+  IESelfJoinSweep(
+      index, B, [&](int p) { Z.reset(p); },
+      [&](int pos, int off1) { EmitRuns(B, Z, n, Li[pos], off1, result); });
+  return result;
+}
+
+// IEJoin emitting (Li[i], start, end) runs instead of single pairs;
+// result.right_ids holds the right row ids in Lr1 order.
+template <typename BitArray = boost::dynamic_bitset<>>
+RangeJoinResult IEJoinRanges(const DataFrameView &T, const DataFrameView &Tr,
+                             const std::vector<Predicate> &preds,
+                             int trace = 0) {
+  IEJoinIndex index = PrepareIEJoin(T, Tr, preds, trace);
+  const auto &Li = index.Li;
+  int n = index.n;
+  RangeJoinResult result;
+  result.right_ids.assign(index.Lk.begin(), index.Lk.end());
+
+  BitArray B(n);
+  BitArray Z(n);
+  Z.set();
+  IEJoinSweep(
+      index, B, [&](int p) { Z.reset(p); },
+      [&](int i, int off1) { EmitRuns(B, Z, n, Li[i], off1, result); });
+  return result;
+}
+// COUNT/SUM/MIN/MAX of a value column over the matches of one left row.
+struct JoinAggregate {
+  int row_id;
+  long count = 0;
+  long sum = 0;
+  DataType min = std::numeric_limits<DataType>::max();
+  DataType max = std::numeric_limits<DataType>::min();
+
+  void add(DataType value) {
+    count += 1;
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+  }
+
+  // also aggregate the matches of other, a disjoint set
+  void merge(const JoinAggregate &other) {
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+  }
+};
+
+// Fenwick trees over the bit positions of B, updated together with B.set.
+// COUNT and SUM of the set bits >= off are totals minus a prefix; MIN and MAX
+// use prefix trees over reversed positions, which is valid because bits are
+// only ever set, never cleared. Every operation is O(log n).
+class FenwickAggregates {
+public:
+  explicit FenwickAggregates(int n)
+      : n(n), count(n + 1), sum(n + 1),
+        min(n + 1, std::numeric_limits<DataType>::max()),
+        max(n + 1, std::numeric_limits<DataType>::min()) {}
+
+  void add(int p, DataType value) {
+    total_count += 1;
+    total_sum += value;
+    for (int k = p + 1; k <= n; k += k & -k) {
+      count[k] += 1;
+      sum[k] += value;
+    }
+    for (int k = n - p; k <= n; k += k & -k) {
+      min[k] = std::min(min[k], value);
+      max[k] = std::max(max[k], value);
+    }
+  }
+
+  // aggregate over the set bits at positions >= off
+  JoinAggregate suffix(int off) const {
+    JoinAggregate result;
+    result.count = total_count;
+    result.sum = total_sum;
+    for (int k = off; k > 0; k -= k & -k) {
+      result.count -= count[k];
+      result.sum -= sum[k];
+    }
+    for (int k = n - off; k > 0; k -= k & -k) {
+      result.min = std::min(result.min, min[k]);
+      result.max = std::max(result.max, max[k]);
+    }
+    return result;
+  }
+
+private:
+  int n;
+  long total_count = 0;
+  long total_sum = 0;
+  std::vector<long> count;
+  std::vector<long> sum;
+  std::vector<DataType> min;
+  std::vector<DataType> max;
+};
+
+// For every row r of T, aggregate value_col over the rows s with (r, s) in
+// IESelfJoin(T, preds), without materializing any pair. result[r] belongs to
+// row r; O(n log n) overall.
+template <typename BitArray = boost::dynamic_bitset<>>
+std::vector<JoinAggregate> IESelfJoinAggregate(const DataFrameView &T,
+                                               const std::vector<Predicate> &preds,
+                                               const std::string &value_col,
+                                               int trace = 0) {
+  const ColumnSpan &values = T.get_column(T.col_index(value_col));
+  int n = T.num_rows();
+  std::vector<JoinAggregate> result(n);
+  for (int r = 0; r < n; ++r) {
+    result[r].row_id = r;
+  }
+
+  auto halves = SplitNotEqual(preds);
+  if (!halves.empty()) {
+    for (const auto &half : halves) {
+      auto part = IESelfJoinAggregate<BitArray>(T, half, value_col, trace);
+      for (int r = 0; r < n; ++r) {
+        result[r].merge(part[r]);
+      }
+    }
+    return result;
+  }
+  if (DetectSymmetry(preds) == kSymmetric) {
+    // every row matches the run of its own key: aggregate each run once
+    RangeJoinResult runs = IESelfJoinRanges<BitArray>(T, preds, trace);
+    int start = -1;
+    JoinAggregate run_aggregate;
+    for (const auto &run : runs.runs) {
+      if (run.start != start) {
+        start = run.start;
+        run_aggregate = JoinAggregate();
+        for (int j = run.start; j < run.end; ++j) {
+          run_aggregate.add(values[runs.right_ids[j]]);
+        }
+      }
+      run_aggregate.row_id = run.left;
+      result[run.left] = run_aggregate;
+    }
+    return result;
+  }
+
+  IESelfJoinIndex index = PrepareIESelfJoin(T, preds, trace);
+  const auto &Li = index.Li;
+  BitArray B(n);
+  FenwickAggregates aggregates(n);
+  IESelfJoinSweep(
+      index, B, [&](int p) { aggregates.add(p, values[Li[p]]); },
+      [&](int pos, int off1) {
+        JoinAggregate aggregate = aggregates.suffix(off1);
+        aggregate.row_id = Li[pos];
+        result[Li[pos]] = aggregate;
+      });
+  return result;
+}
+
+// For every row r of T, aggregate value_col of Tr over the rows s with
+// (r, s) in IEJoin(T, Tr, preds). result[r] belongs to row r of T.
+template <typename BitArray = boost::dynamic_bitset<>>
+std::vector<JoinAggregate> IEJoinAggregate(const DataFrameView &T,
+                                           const DataFrameView &Tr,
+                                           const std::vector<Predicate> &preds,
+                                           const std::string &value_col,
+                                           int trace = 0) {
+  const ColumnSpan &values = Tr.get_column(Tr.col_index(value_col));
+  IEJoinIndex index = PrepareIEJoin(T, Tr, preds, trace);
+  const auto &Li = index.Li;
+  const auto &Lk = index.Lk;
+  // Li holds row ids of T; rows with a NULL key are not in the index and
+  // keep the empty aggregate
+  int m = T.num_rows();
+  std::vector<JoinAggregate> result(m);
+  for (int r = 0; r < m; ++r) {
+    result[r].row_id = r;
+  }
+
+  BitArray B(index.n);
+  FenwickAggregates aggregates(index.n);
+  IEJoinSweep(
+      index, B, [&](int p) { aggregates.add(p, values[Lk[p]]); },
+      [&](int i, int off1) {
+        JoinAggregate aggregate = aggregates.suffix(off1);
+        aggregate.row_id = Li[i];
+        result[Li[i]] = aggregate;
+      });
+  return result;
+}
+
 // See dataframe interface reference
 // https://arrow.apache.org/datafusion-python/generated/datafusion.DataFrame.html#datafusion.DataFrame.filter
 void test_iejoin_employees(std::string_view filename) {
   // create an empty Dataframe object
   DataFrame employees;
-  // recreate a Dataframe object from csv file or another
-  employees.read_csv(filename);
+  // recreate a Dataframe object from the columns of the csv file the join uses
+  employees.read_csv(filename, frame::CsvOptions{',', {"salary", "tax"}, {}});
 
   //  std::cout << employees << std::endl;
 
@@ -448,6 +1470,24 @@ bool has_intersection_values(int min_1, int max_1, int min_2, int max_2) {
   return ret;
 }
 
+// whether some l in [min_1, max_1] and r in [min_2, max_2] satisfy l op r
+bool may_satisfy(kOperator op, long min_1, long max_1, long min_2, long max_2) {
+  switch (op) {
+  case kLess:
+    return min_1 < max_2;
+  case kLessEqual:
+    return min_1 <= max_2;
+  case kGreater:
+    return max_1 > min_2;
+  case kGreaterEqual:
+    return max_1 >= min_2;
+  case kEqual:
+    return has_intersection_values(min_1, max_1, min_2, max_2);
+  default:
+    return true;
+  }
+}
+
 struct Partition {
   int id;
   std::unordered_map<std::string, Metadata> metadata;
@@ -461,16 +1501,20 @@ bool has_intersection(const Metadata &min_max_1, const Metadata &min_max_2) {
 std::vector<std::pair<int, int>>
 virtual_cross_join_eq(std::vector<Partition> &lhs, std::vector<Partition> &rhs,
                       std::string X, std::string Y, bool trace = 1) {
-  std::cerr << "virtual_cross_join: " << rhs.size() << " x " << lhs.size()
-            << "\n";
+  if (trace) {
+    std::cerr << "virtual_cross_join: " << rhs.size() << " x " << lhs.size()
+              << "\n";
+  }
   std::vector<std::pair<int, int>> result;
   for (auto &lhs_metadata : lhs) {
     for (auto &rhs_metadata : rhs) {
 
-      std::cout << "(" << lhs_metadata.metadata[X].min << " - "
-                << lhs_metadata.metadata[X].max << ") | ("
-                << lhs_metadata.metadata[Y].min << " - "
-                << lhs_metadata.metadata[Y].max << ")\n";
+      if (trace) {
+        std::cout << "(" << lhs_metadata.metadata[X].min << " - "
+                  << lhs_metadata.metadata[X].max << ") | ("
+                  << lhs_metadata.metadata[Y].min << " - "
+                  << lhs_metadata.metadata[Y].max << ")\n";
+      }
 
       if (has_intersection(lhs_metadata.metadata[X],
                            rhs_metadata.metadata[Y]) or
@@ -488,18 +1532,25 @@ virtual_cross_join_eq(std::vector<Partition> &lhs, std::vector<Partition> &rhs,
   return result;
 }
 
+// Partition pairs whose key ranges may satisfy both predicates: the left
+// partitions carry the min/max of the lhs columns of preds, the right ones
+// of the rhs columns.
 std::vector<std::pair<int, int>>
 virtual_cross_join(std::vector<Partition> &lhs, std::vector<Partition> &rhs,
-                   std::string X, std::string Y, bool trace = 1) {
-  std::cerr << "virtual_cross_join: " << rhs.size() << " x " << lhs.size()
-            << "\n";
+                   const std::vector<Predicate> &preds, bool trace = 1) {
+  if (trace) {
+    std::cerr << "virtual_cross_join: " << rhs.size() << " x " << lhs.size()
+              << "\n";
+  }
   std::vector<std::pair<int, int>> result;
   for (auto &lhs_metadata : lhs) {
     for (auto &rhs_metadata : rhs) {
-      if (has_intersection(lhs_metadata.metadata[X],
-                           rhs_metadata.metadata[X]) or
-          has_intersection(lhs_metadata.metadata[Y],
-                           rhs_metadata.metadata[Y])) {
+      const Metadata &lx = lhs_metadata.metadata[preds[0].lhs];
+      const Metadata &ly = lhs_metadata.metadata[preds[1].lhs];
+      const Metadata &rx = rhs_metadata.metadata[preds[0].rhs];
+      const Metadata &ry = rhs_metadata.metadata[preds[1].rhs];
+      if (may_satisfy(preds[0].operator_name, lx.min, lx.max, rx.min, rx.max) &&
+          may_satisfy(preds[1].operator_name, ly.min, ly.max, ry.min, ry.max)) {
         std::pair<int, int> t(lhs_metadata.id, rhs_metadata.id);
         if (trace) {
           std::cout << "has_intersection>> (" << std::get<0>(t) << ", "
@@ -513,23 +1564,16 @@ virtual_cross_join(std::vector<Partition> &lhs, std::vector<Partition> &rhs,
 }
 
 std::vector<std::pair<int, int>>
-ScalableIEJoin(const DataFrame &left, const DataFrame &right,
+ScalableIEJoin(const DataFrameView &left, const DataFrameView &right,
                const std::vector<Predicate> &preds, int trace = 0) {
-  auto op1 = preds[0].condition();
   auto X = preds[0].lhs;
-
-  auto op2 = preds[1].condition();
+  auto Xr = preds[0].rhs;
   auto Y = preds[1].lhs;
-  auto op_name1 = preds[0].operator_name;
-  auto op_name2 = preds[1].operator_name;
-
-  // insert row_index column to both dataframes
-  auto lhs = ArrayOf(left, {X, Y});
-  auto rhs = ArrayOf(right, {X, Y});
+  auto Yr = preds[1].rhs;
 
-  // why do we need to sort?
-  lhs = lhs.sort_by(X);
-  rhs = rhs.sort_by(Y);
+  // (rid, X, Y) sorted, so that the partitions are narrow key ranges
+  DataFrame lhs = ArrayOf(left, {X, Y}).sort_by(X);
+  DataFrame rhs = ArrayOf(right, {Xr, Yr}).sort_by(Yr);
 
   // optimize partition sort
   const float kBucketSize = 1000;
@@ -542,27 +1586,50 @@ ScalableIEJoin(const DataFrame &left, const DataFrame &right,
   auto lsh_parts = lhs.partition(lhs_num_parts);
   auto rhs_parts = rhs.partition(rhs_num_parts);
 
+  // empty partitions have no min/max and join with nothing
   std::vector<Partition> partitions_lhs;
   for (int i = 0; i < lhs_num_parts; ++i) {
-    partitions_lhs.emplace_back(
-        Partition{.id = i, .metadata = lsh_parts[i].min_max({X, Y})});
+    if (lsh_parts[i].num_rows() > 0) {
+      partitions_lhs.emplace_back(
+          Partition{.id = i, .metadata = lsh_parts[i].min_max({X, Y})});
+    }
   }
 
   std::vector<Partition> partitions_rhs;
   for (int i = 0; i < rhs_num_parts; ++i) {
-    partitions_rhs.emplace_back(
-        Partition{.id = i, .metadata = rhs_parts[i].min_max({X, Y})});
+    if (rhs_parts[i].num_rows() > 0) {
+      partitions_rhs.emplace_back(
+          Partition{.id = i, .metadata = rhs_parts[i].min_max({Xr, Yr})});
+    }
   }
 
   std::vector<std::pair<int, int>> result;
   auto cross_join_result =
-      virtual_cross_join(partitions_lhs, partitions_rhs, X, Y, trace);
-  std::cout << "cross_join_result.sz: " << cross_join_result.size()
-            << std::endl;
-  for (int index = 0; index < cross_join_result.size(); index++) {
-    auto [lhs_part_index, rhs_part_index] = cross_join_result[index];
-    auto expected = IEJoin(lsh_parts[lhs_part_index], rhs_parts[rhs_part_index],
-                           preds, trace);
+      virtual_cross_join(partitions_lhs, partitions_rhs, preds, trace);
+  if (trace) {
+    std::cout << "cross_join_result.sz: " << cross_join_result.size()
+              << std::endl;
+  }
+  // partition pairs are independent tasks on the shared scheduler; IEJoin
+  // returns rows of the partitions, their row_index maps them back to rows
+  // of left and right
+  std::vector<std::vector<std::pair<int, int>>> pair_results(
+      cross_join_result.size());
+  frame::parallel_for(0, cross_join_result.size(), 1, [&](size_t lo, size_t hi) {
+    for (size_t index = lo; index < hi; index++) {
+      auto [lhs_part_index, rhs_part_index] = cross_join_result[index];
+      const DataFrameView &lhs_part = lsh_parts[lhs_part_index];
+      const DataFrameView &rhs_part = rhs_parts[rhs_part_index];
+      const ColumnSpan &lhs_rows =
+          lhs_part.get_column(lhs_part.col_index("row_index"));
+      const ColumnSpan &rhs_rows =
+          rhs_part.get_column(rhs_part.col_index("row_index"));
+      for (const auto &[x, y] : IEJoin(lhs_part, rhs_part, preds, trace)) {
+        pair_results[index].emplace_back(lhs_rows[x], rhs_rows[y]);
+      }
+    }
+  });
+  for (const auto &expected : pair_results) {
     for (const auto &[x, y] : expected) {
       result.emplace_back(std::make_pair(x, y));
     }
@@ -570,8 +1637,77 @@ ScalableIEJoin(const DataFrame &left, const DataFrame &right,
   return result;
 }
 
-std::vector<std::pair<int, int>> ScalableLoopJoin(const DataFrame &left,
-                                                  const DataFrame &right,
+// Row group pairs of two columnar files whose zone maps may satisfy both
+// predicates, from the file metadata alone. A row group whose key column is
+// all NULL is in no pair.
+std::vector<std::pair<int, int>>
+ZonePrunedPairs(const frame::ColumnarFile<DataType> &left,
+                const frame::ColumnarFile<DataType> &right,
+                const std::vector<Predicate> &preds) {
+  size_t lx = left.col_index(preds[0].lhs);
+  size_t ly = left.col_index(preds[1].lhs);
+  size_t rx = right.col_index(preds[0].rhs);
+  size_t ry = right.col_index(preds[1].rhs);
+  auto all_null = [](const frame::ColumnarFile<DataType> &file, size_t g,
+                     size_t c) {
+    return file.zone(g, c).null_count == file.row_group_size(g);
+  };
+  std::vector<std::pair<int, int>> pairs;
+  for (size_t l = 0; l < left.num_row_groups(); ++l) {
+    if (all_null(left, l, lx) || all_null(left, l, ly)) {
+      continue;
+    }
+    for (size_t r = 0; r < right.num_row_groups(); ++r) {
+      if (all_null(right, r, rx) || all_null(right, r, ry)) {
+        continue;
+      }
+      const auto &a = left.zone(l, lx);
+      const auto &b = left.zone(l, ly);
+      const auto &c = right.zone(r, rx);
+      const auto &d = right.zone(r, ry);
+      if (may_satisfy(preds[0].operator_name, a.min, a.max, c.min, c.max) &&
+          may_satisfy(preds[1].operator_name, b.min, b.max, d.min, d.max)) {
+        pairs.emplace_back(l, r);
+      }
+    }
+  }
+  return pairs;
+}
+
+// ScalableIEJoin of two columnar files with their row groups as the
+// partitions: the pairs are pruned on the zone maps before any value is
+// read, and only the row groups of the remaining pairs are read. Returns
+// pairs of row ids of left and right.
+std::vector<std::pair<int, int>>
+ScalableIEJoin(const frame::ColumnarFile<DataType> &left,
+               const frame::ColumnarFile<DataType> &right,
+               const std::vector<Predicate> &preds, int trace = 0) {
+  auto pairs = ZonePrunedPairs(left, right, preds);
+  if (trace) {
+    std::cerr << "row group pairs: " << pairs.size() << " of "
+              << left.num_row_groups() * right.num_row_groups() << std::endl;
+  }
+  std::vector<std::vector<std::pair<int, int>>> pair_results(pairs.size());
+  frame::parallel_for(0, pairs.size(), 1, [&](size_t lo, size_t hi) {
+    for (size_t index = lo; index < hi; index++) {
+      auto [l, r] = pairs[index];
+      int lhs_offset = left.row_group_offset(l);
+      int rhs_offset = right.row_group_offset(r);
+      for (const auto &[x, y] :
+           IEJoin(left.row_group(l), right.row_group(r), preds, trace)) {
+        pair_results[index].emplace_back(lhs_offset + x, rhs_offset + y);
+      }
+    }
+  });
+  std::vector<std::pair<int, int>> result;
+  for (const auto &expected : pair_results) {
+    result.insert(result.end(), expected.begin(), expected.end());
+  }
+  return result;
+}
+
+std::vector<std::pair<int, int>> ScalableLoopJoin(const DataFrameView &left,
+                                                  const DataFrameView &right,
                                                   Predicate &pred,
                                                   int trace = 0) {
   auto op1 = pred.condition();
@@ -613,12 +1749,20 @@ std::vector<std::pair<int, int>> ScalableLoopJoin(const DataFrame &left,
   std::vector<std::pair<int, int>> result;
   auto cross_join_result =
       virtual_cross_join_eq(partitions_lhs, partitions_rhs, X, Y, trace);
-  std::cout << "cross_join_result.sz: " << cross_join_result.size()
-            << std::endl;
-  for (int index = 0; index < cross_join_result.size(); index++) {
-    auto [lhs_part_index, rhs_part_index] = cross_join_result[index];
-    auto expected = LoopJoin(lsh_parts[lhs_part_index],
-                             rhs_parts[rhs_part_index], {pred}, trace);
+  if (trace) {
+    std::cout << "cross_join_result.sz: " << cross_join_result.size()
+              << std::endl;
+  }
+  std::vector<std::vector<std::tuple<int, int>>> pair_results(
+      cross_join_result.size());
+  frame::parallel_for(0, cross_join_result.size(), 1, [&](size_t lo, size_t hi) {
+    for (size_t index = lo; index < hi; index++) {
+      auto [lhs_part_index, rhs_part_index] = cross_join_result[index];
+      pair_results[index] = LoopJoin(lsh_parts[lhs_part_index],
+                                     rhs_parts[rhs_part_index], {pred}, trace);
+    }
+  });
+  for (const auto &expected : pair_results) {
     for (const auto &[x, y] : expected) {
       result.emplace_back(std::make_pair(x, y));
     }
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "iejoin.h"
+
+// Binary file of join results, written batch by batch from a join sink and
+// read back batch by batch, so that neither side holds the whole result. The
+// file is a ResultFileHeader and a sequence of blocks, each a
+// ResultBlockHeader and its payload:
+//
+//   kPairBlock      count (left, right) pairs
+//   kRightIdsBlock  count right row ids, the table of the kRunBlocks after it
+//   kRunBlock       count JoinRuns (left, start, end) over that table
+//
+// Payloads are int32 values, or with kDeltaVarint the zigzag-encoded
+// difference of every value from the same field of the previous entry of
+// the block as a LEB128 varint: sorted or clustered ids take one or two
+// bytes instead of four. Headers and int32 values are copied in the byte
+// order of the machine, so the format is little-endian only.
+
+struct ResultFileOptions {
+  // delta-varint encode the payloads
+  bool delta_varint = true;
+};
+
+namespace result {
+
+static_assert(std::endian::native == std::endian::little,
+              "join result files are written as little-endian values");
+
+const char kMagic[8] = {'J', 'O', 'I', 'N', 'P', 'A', 'I', 'R'};
+const uint32_t kVersion = 1;
+
+// ResultFileHeader::encoding
+const uint32_t kRaw = 0;
+const uint32_t kDeltaVarint = 1;
+
+// ResultBlockHeader::kind
+const uint32_t kPairBlock = 0;
+const uint32_t kRightIdsBlock = 1;
+const uint32_t kRunBlock = 2;
+
+struct ResultFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t encoding;
+};
+
+struct ResultBlockHeader {
+  uint32_t kind;
+  uint32_t count; // entries in the block
+  uint64_t bytes; // of the payload
+};
+
+void PutVarint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+uint64_t GetVarint(const char *&p, const char *end) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p == end) {
+      break;
+    }
+    uint8_t byte = static_cast<uint8_t>(*p++);
+    value |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw std::runtime_error("truncated varint in join result file");
+}
+
+uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Payload of count entries of width int32 fields each, given field by
+// field through value(entry, field).
+template <typename Value>
+std::string Encode(uint32_t encoding, size_t count, size_t width,
+                   Value &&value) {
+  std::string out;
+  if (encoding == kRaw) {
+    out.resize(count * width * sizeof(int32_t));
+    char *p = out.data();
+    for (size_t e = 0; e < count; ++e) {
+      for (size_t f = 0; f < width; ++f, p += sizeof(int32_t)) {
+        int32_t v = value(e, f);
+        std::memcpy(p, &v, sizeof(v));
+      }
+    }
+    return out;
+  }
+  out.reserve(count * width * 2);
+  std::vector<int64_t> previous(width, 0);
+  for (size_t e = 0; e < count; ++e) {
+    for (size_t f = 0; f < width; ++f) {
+      int64_t v = value(e, f);
+      PutVarint(out, ZigZag(v - previous[f]));
+      previous[f] = v;
+    }
+  }
+  return out;
+}
+
+// Decode a payload made by Encode, calling store(entry, field, value).
+template <typename Store>
+void Decode(uint32_t encoding, const std::string &payload, size_t count,
+            size_t width, Store &&store) {
+  const char *p = payload.data();
+  const char *end = p + payload.size();
+  if (encoding == kRaw) {
+    if (payload.size() != count * width * sizeof(int32_t)) {
+      throw std::runtime_error("bad block size in join result file");
+    }
+    for (size_t e = 0; e < count; ++e) {
+      for (size_t f = 0; f < width; ++f, p += sizeof(int32_t)) {
+        int32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        store(e, f, v);
+      }
+    }
+    return;
+  }
+  std::vector<int64_t> previous(width, 0);
+  for (size_t e = 0; e < count; ++e) {
+    for (size_t f = 0; f < width; ++f) {
+      previous[f] += UnZigZag(GetVarint(p, end));
+      store(e, f, static_cast<int32_t>(previous[f]));
+    }
+  }
+}
+
+} // namespace result
+
+// Writes join results to a file as they are produced: pass sink() to a join
+// taking a JoinSink, or write batches and range-encoded results directly.
+class ResultWriter {
+public:
+  explicit ResultWriter(const std::string &filename,
+                        const ResultFileOptions &options = {})
+      : writer(filename, std::ios::binary | std::ios::trunc),
+        encoding(options.delta_varint ? result::kDeltaVarint : result::kRaw) {
+    if (!writer) {
+      throw std::invalid_argument(filename + " is invalid!");
+    }
+    result::ResultFileHeader header{};
+    std::memcpy(header.magic, result::kMagic, sizeof(header.magic));
+    header.version = result::kVersion;
+    header.encoding = encoding;
+    put(&header, sizeof(header));
+  }
+
+  void write(const std::vector<std::pair<int, int>> &batch) {
+    for (size_t first = 0; first < batch.size(); first += kBlockEntries) {
+      size_t count = std::min(kBlockEntries, batch.size() - first);
+      block(result::kPairBlock, count,
+            result::Encode(encoding, count, 2, [&](size_t e, size_t f) {
+              const auto &pair = batch[first + e];
+              return f == 0 ? pair.first : pair.second;
+            }));
+    }
+    num_pairs += batch.size();
+  }
+
+  // the runs of ranges, stored as runs: a long run costs one entry
+  void write(const RangeJoinResult &ranges) {
+    // the runs index the whole table, so it is a single block
+    const auto &ids = ranges.right_ids;
+    block(result::kRightIdsBlock, ids.size(),
+          result::Encode(encoding, ids.size(), 1,
+                         [&](size_t e, size_t) { return ids[e]; }));
+    const auto &runs = ranges.runs;
+    for (size_t first = 0; first < runs.size(); first += kBlockEntries) {
+      size_t count = std::min(kBlockEntries, runs.size() - first);
+      block(result::kRunBlock, count,
+            result::Encode(encoding, count, 3, [&](size_t e, size_t f) {
+              const JoinRun &run = runs[first + e];
+              return f == 0 ? run.left : f == 1 ? run.start : run.end;
+            }));
+    }
+    num_pairs += ranges.num_pairs();
+  }
+
+  JoinSink sink() {
+    return [this](const std::vector<std::pair<int, int>> &batch) {
+      write(batch);
+    };
+  }
+
+  // flush the file, reporting write errors
+  void close() {
+    writer.flush();
+    if (!writer) {
+      throw std::runtime_error("writing the join result file failed");
+    }
+    writer.close();
+  }
+
+  size_t pairs() const { return num_pairs; }
+
+  size_t bytes() const { return num_bytes; }
+
+private:
+  // entries per block, bounds the memory of the reader
+  static constexpr size_t kBlockEntries = size_t(1) << 16;
+
+  void put(const void *bytes, size_t size) {
+    writer.write(static_cast<const char *>(bytes), size);
+    num_bytes += size;
+  }
+
+  void block(uint32_t kind, size_t count, const std::string &payload) {
+    result::ResultBlockHeader header{kind, static_cast<uint32_t>(count),
+                                     payload.size()};
+    put(&header, sizeof(header));
+    put(payload.data(), payload.size());
+  }
+
+  std::ofstream writer;
+  uint32_t encoding;
+  size_t num_pairs = 0;
+  size_t num_bytes = 0;
+};
+
+// Reads a file written by ResultWriter back as batches of pairs: a pair
+// block at a time, and runs expanded into batches of at most
+// kReadBatch pairs, so a long run is never held expanded.
+class ResultReader {
+public:
+  explicit ResultReader(const std::string &filename)
+      : reader(filename, std::ios::binary) {
+    if (!reader) {
+      throw std::invalid_argument(filename + " is invalid!");
+    }
+    result::ResultFileHeader header;
+    reader.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!reader || std::memcmp(header.magic, result::kMagic, 8) != 0) {
+      throw std::runtime_error(filename + " is not a join result file");
+    }
+    if (header.version == 0 || header.version > result::kVersion ||
+        header.encoding > result::kDeltaVarint) {
+      throw std::runtime_error(filename + ": unknown version or encoding");
+    }
+    encoding = header.encoding;
+    reader.seekg(0, std::ios::end);
+    file_size = static_cast<uint64_t>(reader.tellg());
+    reader.seekg(sizeof(header));
+  }
+
+  // the next pairs into batch, false at the end of the file
+  bool next(std::vector<std::pair<int, int>> &batch) {
+    batch.clear();
+    while (batch.empty()) {
+      if (run < runs.size()) {
+        Expand(batch);
+        continue;
+      }
+      result::ResultBlockHeader header;
+      reader.read(reinterpret_cast<char *>(&header), sizeof(header));
+      if (reader.gcount() == 0) {
+        return false;
+      }
+      if (reader.gcount() != sizeof(header)) {
+        throw std::runtime_error("truncated join result file");
+      }
+      // a corrupt size must not allocate past the end of the file
+      uint64_t remaining = file_size - static_cast<uint64_t>(reader.tellg());
+      if (header.bytes > remaining) {
+        throw std::runtime_error("truncated join result file");
+      }
+      std::string payload(header.bytes, '\0');
+      reader.read(payload.data(), header.bytes);
+      if (reader.gcount() != static_cast<std::streamsize>(header.bytes)) {
+        throw std::runtime_error("truncated join result file");
+      }
+      if (header.kind == result::kPairBlock) {
+        batch.resize(header.count);
+        result::Decode(encoding, payload, header.count, 2,
+                       [&](size_t e, size_t f, int32_t v) {
+                         (f == 0 ? batch[e].first : batch[e].second) = v;
+                       });
+      } else if (header.kind == result::kRightIdsBlock) {
+        right_ids.resize(header.count);
+        result::Decode(encoding, payload, header.count, 1,
+                       [&](size_t e, size_t, int32_t v) { right_ids[e] = v; });
+      } else if (header.kind == result::kRunBlock) {
+        runs.resize(header.count);
+        result::Decode(encoding, payload, header.count, 3,
+                       [&](size_t e, size_t f, int32_t v) {
+                         (f == 0 ? runs[e].left
+                                 : f == 1 ? runs[e].start : runs[e].end) = v;
+                       });
+        for (const JoinRun &r : runs) {
+          if (r.start < 0 || r.end > static_cast<int>(right_ids.size())) {
+            throw std::runtime_error("run past the right ids of the file");
+          }
+        }
+        run = 0;
+        j = runs.empty() ? 0 : runs[0].start;
+      } else {
+        throw std::runtime_error("unknown block in join result file");
+      }
+    }
+    return true;
+  }
+
+  // all the remaining pairs
+  std::vector<std::pair<int, int>> read_all() {
+    std::vector<std::pair<int, int>> pairs, batch;
+    while (next(batch)) {
+      pairs.insert(pairs.end(), batch.begin(), batch.end());
+    }
+    return pairs;
+  }
+
+private:
+  static constexpr size_t kReadBatch = size_t(1) << 16;
+
+  // the pairs of the pending runs, up to kReadBatch of them
+  void Expand(std::vector<std::pair<int, int>> &batch) {
+    while (run < runs.size() && batch.size() < kReadBatch) {
+      const JoinRun &r = runs[run];
+      for (; j < r.end && batch.size() < kReadBatch; ++j) {
+        batch.emplace_back(r.left, right_ids[j]);
+      }
+      if (j >= r.end && ++run < runs.size()) {
+        j = runs[run].start;
+      }
+    }
+  }
+
+  std::ifstream reader;
+  uint32_t encoding;
+  uint64_t file_size; // bounds the payload of a block
+  std::vector<int> right_ids; // table of the run blocks
+  std::vector<JoinRun> runs;  // of the last run block
+  size_t run = 0;             // next run to expand
+  int j = 0;                  // next position of it in right_ids
+};
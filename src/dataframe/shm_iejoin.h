@@ -0,0 +1,362 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "external_iejoin.h"
+#include "iejoin.h"
+
+// Multi-process IEJoin on one host. The coordinator range-partitions the
+// (rid, X, Y) tuples of both inputs and copies them into a POSIX shared
+// memory segment, together with the list of partition pairs that survive
+// pruning. Forked workers inherit the mapping of the segment, claim
+// partition pairs through an atomic counter in it, copy the two partitions
+// of a pair into frames, join them with IEJoin and stream the pairs back
+// over a pipe; the coordinator gathers them.
+
+struct DistributedOptions {
+  int num_workers = 4;
+  // rows per range partition, as kBucketSize in ScalableIEJoin
+  size_t partition_rows = 1000;
+};
+
+namespace shm {
+
+static_assert(std::atomic<int>::is_always_lock_free,
+              "the task counter is shared between processes");
+
+struct Task {
+  int left;
+  int right;
+};
+
+// a result pair as it crosses the pipe
+struct PairRecord {
+  int left;
+  int right;
+};
+
+// Worker processes and the read ends of their pipes. Whatever path leaves
+// the coordinator, the workers not yet reaped are killed and reaped and the
+// pipes closed, so no child outlives a failed join.
+class Workers {
+public:
+  Workers() = default;
+  Workers(const Workers &) = delete;
+  Workers &operator=(const Workers &) = delete;
+
+  ~Workers() {
+    for (pid_t pid : pids) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+    for (const auto &pipe : pipes) {
+      if (pipe.fd >= 0) {
+        close(pipe.fd);
+      }
+    }
+  }
+
+  void add(pid_t pid, int fd) {
+    pids.push_back(pid);
+    pipes.push_back(pollfd{fd, POLLIN, 0});
+  }
+
+  // reap every worker, true if all of them exited with status 0
+  bool wait() {
+    bool succeeded = true;
+    for (pid_t pid : pids) {
+      int status = 0;
+      while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+      }
+      succeeded &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    pids.clear();
+    return succeeded;
+  }
+
+  std::vector<pollfd> pipes;
+
+private:
+  std::vector<pid_t> pids;
+};
+
+// Layout of the segment: header, left records, right records, left and
+// right partitions, tasks.
+struct Header {
+  std::atomic<int> next_task;
+  int num_tasks;
+  size_t num_left, num_right;
+  size_t num_left_parts, num_right_parts;
+};
+
+// Shared memory segment unlinked and unmapped on destruction.
+class Segment {
+public:
+  explicit Segment(size_t size) : size(size) {
+    static std::atomic<int> counter{0};
+    name = "/iejoin-" + std::to_string(getpid()) + "-" +
+           std::to_string(counter++);
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+      throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+    }
+    if (ftruncate(fd, size) != 0) {
+      close(fd);
+      shm_unlink(name.c_str());
+      throw std::runtime_error("ftruncate " + name + ": " + strerror(errno));
+    }
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      shm_unlink(name.c_str());
+      throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+    }
+  }
+
+  ~Segment() {
+    munmap(data, size);
+    shm_unlink(name.c_str());
+  }
+
+  template <typename Type> Type *at(size_t offset) const {
+    return reinterpret_cast<Type *>(static_cast<char *>(data) + offset);
+  }
+
+private:
+  std::string name;
+  size_t size;
+  void *data;
+};
+
+// Project (rid, X, Y) of table sorted on X.
+std::vector<external::KeyRecord> SortedRecords(const DataFrameView &table,
+                                               const std::string &X,
+                                               const std::string &Y) {
+  const ColumnSpan &xs = table.get_column(table.col_index(X));
+  const ColumnSpan &ys = table.get_column(table.col_index(Y));
+  std::vector<external::KeyRecord> records;
+  records.reserve(table.num_rows());
+  ForEachValid(ValidRows(table, {X, Y}), 0, table.num_rows(), [&](size_t r) {
+    records.push_back(external::KeyRecord{static_cast<int>(r), xs[r], ys[r]});
+  });
+  std::sort(records.begin(), records.end(), external::ByX);
+  return records;
+}
+
+void WriteAll(int fd, const void *data, size_t bytes) {
+  const char *cursor = static_cast<const char *>(data);
+  while (bytes > 0) {
+    ssize_t written = write(fd, cursor, bytes);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      _exit(1);
+    }
+    cursor += written;
+    bytes -= written;
+  }
+}
+
+// Body of a worker process: claim tasks until none is left.
+void Worker(const Segment &segment, const std::vector<Predicate> &preds,
+            int fd) {
+  auto *header = segment.at<Header>(0);
+  size_t offset = sizeof(Header);
+  auto *left = segment.at<external::KeyRecord>(offset);
+  offset += header->num_left * sizeof(external::KeyRecord);
+  auto *right = segment.at<external::KeyRecord>(offset);
+  offset += header->num_right * sizeof(external::KeyRecord);
+  auto *left_parts = segment.at<external::PartitionInfo>(offset);
+  offset += header->num_left_parts * sizeof(external::PartitionInfo);
+  auto *right_parts = segment.at<external::PartitionInfo>(offset);
+  offset += header->num_right_parts * sizeof(external::PartitionInfo);
+  auto *tasks = segment.at<Task>(offset);
+
+  std::vector<PairRecord> batch;
+  std::vector<int> left_rids, right_rids;
+  const size_t kBatchSize = 8192;
+  int task;
+  while ((task = header->next_task.fetch_add(1)) < header->num_tasks) {
+    const external::PartitionInfo &lp = left_parts[tasks[task].left];
+    const external::PartitionInfo &rp = right_parts[tasks[task].right];
+    DataFrame L = external::PartitionFrame(left + lp.offset, lp.count,
+                                           preds[0].lhs, preds[1].lhs,
+                                           left_rids);
+    DataFrame R = external::PartitionFrame(right + rp.offset, rp.count,
+                                           preds[0].rhs, preds[1].rhs,
+                                           right_rids);
+    IEJoinIndex index = PrepareIEJoin(L, R, preds);
+    boost::dynamic_bitset<> B(index.n);
+    IEJoinSweep(index, B, [](int) {}, [&](int i, int off1) {
+      while (true) {
+        int k = FindFrom(B, off1);
+        if (k >= index.n or k == -1) {
+          break;
+        }
+        batch.push_back(
+            PairRecord{left_rids[index.Li[i]], right_rids[index.Lk[k]]});
+        if (batch.size() == kBatchSize) {
+          WriteAll(fd, batch.data(), batch.size() * sizeof(batch[0]));
+          batch.clear();
+        }
+        off1 = k + 1;
+      }
+    });
+  }
+  WriteAll(fd, batch.data(), batch.size() * sizeof(batch[0]));
+}
+
+} // namespace shm
+
+// IEJoin of left and right split into range-partition pairs that run on
+// options.num_workers forked processes sharing the inputs through POSIX
+// shared memory. Returns pairs of row ids of left and right, in no
+// particular order.
+std::vector<std::pair<int, int>>
+DistributedIEJoin(const DataFrameView &left, const DataFrameView &right,
+                  const std::vector<Predicate> &preds,
+                  const DistributedOptions &options = {}) {
+  using external::KeyRecord;
+  using external::PartitionInfo;
+  auto lhs = shm::SortedRecords(left, preds[0].lhs, preds[1].lhs);
+  auto rhs = shm::SortedRecords(right, preds[0].rhs, preds[1].rhs);
+  auto lhs_parts = external::RangePartition(lhs, options.partition_rows);
+  auto rhs_parts = external::RangePartition(rhs, options.partition_rows);
+
+  std::vector<shm::Task> tasks;
+  for (size_t l = 0; l < lhs_parts.size(); ++l) {
+    for (size_t r = 0; r < rhs_parts.size(); ++r) {
+      const auto &lp = lhs_parts[l];
+      const auto &rp = rhs_parts[r];
+      if (may_satisfy(preds[0].operator_name, lp.min_x, lp.max_x, rp.min_x,
+                      rp.max_x) &&
+          may_satisfy(preds[1].operator_name, lp.min_y, lp.max_y, rp.min_y,
+                      rp.max_y)) {
+        tasks.push_back(shm::Task{static_cast<int>(l), static_cast<int>(r)});
+      }
+    }
+  }
+
+  size_t size = sizeof(shm::Header) +
+                (lhs.size() + rhs.size()) * sizeof(KeyRecord) +
+                (lhs_parts.size() + rhs_parts.size()) * sizeof(PartitionInfo) +
+                tasks.size() * sizeof(shm::Task);
+  shm::Segment segment(size);
+  auto *header = new (segment.at<shm::Header>(0)) shm::Header;
+  header->next_task.store(0);
+  header->num_tasks = tasks.size();
+  header->num_left = lhs.size();
+  header->num_right = rhs.size();
+  header->num_left_parts = lhs_parts.size();
+  header->num_right_parts = rhs_parts.size();
+  size_t offset = sizeof(shm::Header);
+  auto copy = [&](const auto &items) {
+    std::memcpy(segment.at<char>(offset), items.data(),
+                items.size() * sizeof(items[0]));
+    offset += items.size() * sizeof(items[0]);
+  };
+  copy(lhs);
+  copy(rhs);
+  copy(lhs_parts);
+  copy(rhs_parts);
+  copy(tasks);
+  // the coordinator keeps only the shared copy
+  lhs = {};
+  rhs = {};
+
+  shm::Workers workers;
+  std::vector<pollfd> &pipes = workers.pipes;
+  int num_workers = std::max(1, std::min<int>(options.num_workers, tasks.size()));
+  for (int w = 0; w < num_workers; ++w) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      throw std::runtime_error(std::string("pipe: ") + strerror(errno));
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      int error = errno;
+      close(fds[0]);
+      close(fds[1]);
+      throw std::runtime_error(std::string("fork: ") + strerror(error));
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      for (const auto &other : pipes) {
+        close(other.fd);
+      }
+      int status = 0;
+      try {
+        shm::Worker(segment, preds, fds[1]);
+      } catch (const std::exception &error) {
+        std::cerr << "DistributedIEJoin worker: " << error.what() << std::endl;
+        status = 1;
+      }
+      close(fds[1]);
+      _exit(status);
+    }
+    close(fds[1]);
+    workers.add(pid, fds[0]);
+  }
+
+  // gather until every worker closed its pipe
+  std::vector<std::pair<int, int>> result;
+  std::vector<char> buffer(size_t(1) << 16);
+  std::vector<std::vector<char>> partial(pipes.size());
+  size_t open_pipes = pipes.size();
+  while (open_pipes > 0) {
+    if (poll(pipes.data(), pipes.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("poll: ") + strerror(errno));
+    }
+    for (size_t w = 0; w < pipes.size(); ++w) {
+      if (pipes[w].fd < 0 || !(pipes[w].revents & (POLLIN | POLLHUP))) {
+        continue;
+      }
+      ssize_t bytes = read(pipes[w].fd, buffer.data(), buffer.size());
+      if (bytes < 0) {
+        if (errno == EINTR) {
+          continue; // polled again, the pipe is still readable
+        }
+        throw std::runtime_error(std::string("read: ") + strerror(errno));
+      }
+      if (bytes == 0) {
+        close(pipes[w].fd);
+        pipes[w].fd = -1;
+        open_pipes -= 1;
+        continue;
+      }
+      // pairs may straddle two reads
+      auto &pending = partial[w];
+      pending.insert(pending.end(), buffer.begin(), buffer.begin() + bytes);
+      size_t whole = pending.size() / sizeof(shm::PairRecord);
+      for (size_t p = 0; p < whole; ++p) {
+        shm::PairRecord pair;
+        std::memcpy(&pair, pending.data() + p * sizeof(pair), sizeof(pair));
+        result.emplace_back(pair.left, pair.right);
+      }
+      pending.erase(pending.begin(),
+                    pending.begin() + whole * sizeof(shm::PairRecord));
+    }
+  }
+
+  if (!workers.wait()) {
+    throw std::runtime_error("DistributedIEJoin: a worker process failed");
+  }
+  return result;
+}
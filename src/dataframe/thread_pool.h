@@ -0,0 +1,419 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+namespace frame
+{
+  // Process-wide work-stealing task scheduler shared by the Dataframe
+  // operators and the joins, so concurrent operators share one set of
+  // threads instead of oversubscribing the cores.
+  //
+  // Every worker owns a deque: it pushes and pops its own tasks at the back
+  // (LIFO, cache friendly) and steals from the front of the other deques when
+  // its own is empty. Tasks submitted from outside the pool are spread round
+  // robin. Threads waiting on a TaskGroup run pending tasks meanwhile, so
+  // nested parallel sections cannot deadlock.
+  //
+  // The worker count comes from configure(), else the IEJOIN_NUM_THREADS
+  // environment variable, else std::thread::hardware_concurrency(). After a
+  // fork() the child has no workers and runs every task inline.
+  class TaskScheduler
+  {
+  public:
+    using Task = std::function<void()>;
+
+    static TaskScheduler &instance()
+    {
+      std::lock_guard<std::mutex> lock(instance_mutex());
+      auto &scheduler = instance_ptr();
+      if (!scheduler)
+      {
+        scheduler.reset(new TaskScheduler(default_num_workers(), pin_cores()));
+      }
+      return *scheduler;
+    }
+
+    // replace the process-wide scheduler; call while no task is running
+    static void configure(size_t num_workers, bool pin = false)
+    {
+      std::lock_guard<std::mutex> lock(instance_mutex());
+      auto &scheduler = instance_ptr();
+      scheduler.reset();
+      pin_cores() = pin;
+      scheduler.reset(new TaskScheduler(std::max<size_t>(1, num_workers), pin));
+    }
+
+    ~TaskScheduler()
+    {
+      stopping = true;
+      {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+      }
+      wake.notify_all();
+      for (auto &thread : threads)
+      {
+        thread.join();
+      }
+    }
+
+    [[nodiscard]] size_t num_workers() const { return queues.size(); }
+
+    // false in a forked child, where the worker threads do not exist
+    [[nodiscard]] bool active() const { return getpid() == owner; }
+
+    void submit(Task task)
+    {
+      if (!active())
+      {
+        task();
+        return;
+      }
+      size_t target = current_worker() >= 0 && current_pool() == this
+                          ? current_worker()
+                          : next_queue++ % queues.size();
+      {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(std::move(task));
+      }
+      pending++;
+      {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+      }
+      wake.notify_one();
+    }
+
+    // run one pending task on the calling thread, false if none was found
+    bool run_one()
+    {
+      Task task;
+      if (!take(task))
+        return false;
+      task();
+      return true;
+    }
+
+  private:
+    struct WorkerQueue
+    {
+      std::mutex mutex;
+      std::deque<Task> tasks;
+    };
+
+    TaskScheduler(size_t num_workers, bool pin) : owner(getpid())
+    {
+      for (size_t i = 0; i < num_workers; ++i)
+      {
+        queues.emplace_back(new WorkerQueue);
+      }
+      for (size_t i = 0; i < num_workers; ++i)
+      {
+        threads.emplace_back([this, i, pin]
+                             { worker_loop(i, pin); });
+      }
+    }
+
+    static std::mutex &instance_mutex()
+    {
+      static std::mutex mutex;
+      return mutex;
+    }
+
+    static std::unique_ptr<TaskScheduler> &instance_ptr()
+    {
+      static std::unique_ptr<TaskScheduler> scheduler;
+      return scheduler;
+    }
+
+    static bool &pin_cores()
+    {
+      static bool pin = false;
+      return pin;
+    }
+
+    static size_t default_num_workers()
+    {
+      if (const char *env = std::getenv("IEJOIN_NUM_THREADS"))
+      {
+        long value = std::strtol(env, nullptr, 10);
+        if (value > 0)
+          return value;
+      }
+      return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    static long &current_worker()
+    {
+      thread_local long worker = -1;
+      return worker;
+    }
+
+    static TaskScheduler *&current_pool()
+    {
+      thread_local TaskScheduler *pool = nullptr;
+      return pool;
+    }
+
+    // own deque from the back, then steal from the front of the others
+    bool take(Task &task)
+    {
+      long self = current_pool() == this ? current_worker() : -1;
+      if (self >= 0)
+      {
+        auto &queue = *queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+          task = std::move(queue.tasks.back());
+          queue.tasks.pop_back();
+          pending--;
+          return true;
+        }
+      }
+      size_t start = self >= 0 ? self + 1 : 0;
+      for (size_t k = 0; k < queues.size(); ++k)
+      {
+        auto &queue = *queues[(start + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+          task = std::move(queue.tasks.front());
+          queue.tasks.pop_front();
+          pending--;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void worker_loop(size_t index, bool pin)
+    {
+      current_worker() = index;
+      current_pool() = this;
+      if (pin)
+      {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+      }
+      while (!stopping)
+      {
+        if (run_one())
+          continue;
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this]
+                  { return stopping || pending > 0; });
+      }
+    }
+
+    pid_t owner;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<bool> stopping{false};
+    std::atomic<long> pending{0};
+    std::atomic<size_t> next_queue{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+  };
+
+  // Set of tasks to wait for together. wait() runs pending tasks of the
+  // scheduler until every task of the group finished, then rethrows the
+  // first exception one of them raised.
+  class TaskGroup
+  {
+  public:
+    explicit TaskGroup(TaskScheduler &scheduler = TaskScheduler::instance())
+        : scheduler(scheduler), state(std::make_shared<State>()) {}
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    ~TaskGroup()
+    {
+      try
+      {
+        wait();
+      }
+      catch (...)
+      {
+      }
+    }
+
+    void run(std::function<void()> fn)
+    {
+      state->remaining++;
+      scheduler.submit([state = state, fn = std::move(fn)]
+                       {
+        try {
+          fn();
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (!state->error)
+            state->error = std::current_exception();
+        }
+        if (--state->remaining == 0) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          state->done.notify_all();
+        } });
+    }
+
+    void wait()
+    {
+      while (state->remaining > 0)
+      {
+        if (scheduler.run_one())
+          continue;
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done.wait_for(lock, std::chrono::microseconds(100), [this]
+                             { return state->remaining == 0; });
+      }
+      std::exception_ptr error;
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        std::swap(error, state->error);
+      }
+      if (error)
+        std::rethrow_exception(error);
+    }
+
+  private:
+    struct State
+    {
+      std::atomic<long> remaining{0};
+      std::mutex mutex;
+      std::condition_variable done;
+      std::exception_ptr error;
+    };
+
+    TaskScheduler &scheduler;
+    std::shared_ptr<State> state;
+  };
+
+  // Call fn(lo, hi) over [begin, end) split into chunks of at least grain
+  // items, in parallel on the shared scheduler. Ranges below grain run
+  // inline on the calling thread.
+  template <typename Fn>
+  void parallel_for(size_t begin, size_t end, size_t grain, Fn &&fn)
+  {
+    if (end <= begin)
+      return;
+    TaskScheduler &scheduler = TaskScheduler::instance();
+    size_t n = end - begin;
+    size_t chunks = std::min(n / std::max<size_t>(1, grain),
+                             4 * scheduler.num_workers());
+    if (chunks <= 1 || !scheduler.active())
+    {
+      fn(begin, end);
+      return;
+    }
+    TaskGroup group(scheduler);
+    size_t step = (n + chunks - 1) / chunks;
+    for (size_t lo = begin + step; lo < end; lo += step)
+    {
+      size_t hi = std::min(end, lo + step);
+      group.run([&fn, lo, hi]
+                { fn(lo, hi); });
+    }
+    fn(begin, std::min(end, begin + step));
+    group.wait();
+  }
+
+  // Sample sort of items on the shared scheduler: splitters drawn from a
+  // sample cut the items into one bucket per task, every task scatters its
+  // slice into the buckets and each bucket is then sorted on its own. less
+  // must be a strict total order (ties broken by row, say) for the result to
+  // be deterministic; std::sort is used below min_items.
+  template <typename Item, typename Less>
+  void parallel_sort(std::vector<Item> &items, Less less, size_t min_items)
+  {
+    TaskScheduler &scheduler = TaskScheduler::instance();
+    size_t n = items.size();
+    size_t num_buckets = 4 * scheduler.num_workers();
+    if (n < std::max<size_t>(min_items, 2) || num_buckets < 2 || !scheduler.active())
+    {
+      std::sort(items.begin(), items.end(), less);
+      return;
+    }
+
+    // evenly spaced sample, oversampled to even out the bucket sizes
+    const size_t oversampling = 32;
+    std::vector<Item> sample;
+    size_t sample_size = std::min(n, num_buckets * oversampling);
+    sample.reserve(sample_size);
+    for (size_t k = 0; k < sample_size; ++k)
+    {
+      sample.push_back(items[k * (n / sample_size)]);
+    }
+    std::sort(sample.begin(), sample.end(), less);
+    std::vector<Item> splitters;
+    for (size_t b = 1; b < num_buckets; ++b)
+    {
+      splitters.push_back(sample[b * sample.size() / num_buckets]);
+    }
+
+    // bucket of every item and bucket sizes per slice
+    size_t num_slices = num_buckets;
+    size_t step = (n + num_slices - 1) / num_slices;
+    std::vector<uint32_t> bucket_of(n);
+    std::vector<std::vector<size_t>> counts(num_slices,
+                                            std::vector<size_t>(num_buckets, 0));
+    parallel_for(0, num_slices, 1, [&](size_t lo, size_t hi)
+                 {
+      for (size_t s = lo; s < hi; ++s)
+        for (size_t i = s * step; i < std::min(n, (s + 1) * step); ++i)
+        {
+          bucket_of[i] = std::upper_bound(splitters.begin(), splitters.end(),
+                                          items[i], less) -
+                         splitters.begin();
+          counts[s][bucket_of[i]]++;
+        } });
+
+    // slice s writes bucket b from offsets[s][b], slices in input order
+    std::vector<size_t> bucket_start(num_buckets + 1, 0);
+    std::vector<std::vector<size_t>> offsets(num_slices,
+                                             std::vector<size_t>(num_buckets));
+    size_t offset = 0;
+    for (size_t b = 0; b < num_buckets; ++b)
+    {
+      bucket_start[b] = offset;
+      for (size_t s = 0; s < num_slices; ++s)
+      {
+        offsets[s][b] = offset;
+        offset += counts[s][b];
+      }
+    }
+    bucket_start[num_buckets] = n;
+
+    std::vector<Item> sorted(n);
+    parallel_for(0, num_slices, 1, [&](size_t lo, size_t hi)
+                 {
+      for (size_t s = lo; s < hi; ++s)
+        for (size_t i = s * step; i < std::min(n, (s + 1) * step); ++i)
+          sorted[offsets[s][bucket_of[i]]++] = std::move(items[i]); });
+    parallel_for(0, num_buckets, 1, [&](size_t lo, size_t hi)
+                 {
+      for (size_t b = lo; b < hi; ++b)
+        std::sort(sorted.begin() + bucket_start[b],
+                  sorted.begin() + bucket_start[b + 1], less); });
+    items = std::move(sorted);
+  }
+} // namespace frame
+#endif // THREAD_POOL_H
@@ -0,0 +1,629 @@
+#ifndef TYPED_DATAFRAME_H
+#define TYPED_DATAFRAME_H
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "csv_reader.h"
+#include "dataframe.h"
+#include "logical_expr.h"
+
+namespace frame
+{
+  // Sorted distinct strings of a column, stored back to back in one arena.
+  // The code of a string is its position, so codes order like the strings.
+  class StringDictionary
+  {
+  public:
+    // dictionary of values, which must be sorted and distinct
+    template <typename Strings>
+    explicit StringDictionary(const Strings &values)
+    {
+      offsets.reserve(values.size() + 1);
+      for (const auto &value : values)
+      {
+        arena.append(value);
+        offsets.push_back(arena.size());
+      }
+    }
+
+    [[nodiscard]] size_t size() const { return offsets.size() - 1; }
+
+    std::string_view operator[](int32_t code) const
+    {
+      return std::string_view(arena).substr(offsets[code], offsets[code + 1] - offsets[code]);
+    }
+
+    // code of the first string not less than value, size() if none
+    [[nodiscard]] int32_t lower_bound(std::string_view value) const
+    {
+      int32_t lo = 0, hi = size();
+      while (lo < hi)
+      {
+        int32_t mid = lo + (hi - lo) / 2;
+        if ((*this)[mid] < value)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      return lo;
+    }
+
+    // code of value, -1 if it is not in the dictionary
+    [[nodiscard]] int32_t find(std::string_view value) const
+    {
+      int32_t code = lower_bound(value);
+      return code < int32_t(size()) && (*this)[code] == value ? code : -1;
+    }
+
+    // Union of a and b; remap_a[code] (resp. remap_b) is the code in the
+    // union of a code of a (resp. b).
+    static std::shared_ptr<const StringDictionary>
+    merge(const StringDictionary &a, const StringDictionary &b,
+          std::vector<int32_t> &remap_a, std::vector<int32_t> &remap_b)
+    {
+      std::vector<std::string_view> values;
+      values.reserve(a.size() + b.size());
+      remap_a.resize(a.size());
+      remap_b.resize(b.size());
+      size_t i = 0, j = 0;
+      while (i < a.size() || j < b.size())
+      {
+        bool take_a = j == b.size() || (i < a.size() && a[i] <= b[j]);
+        bool take_b = i == a.size() || (j < b.size() && b[j] <= a[i]);
+        values.push_back(take_a ? a[i] : b[j]);
+        if (take_a)
+          remap_a[i++] = values.size() - 1;
+        if (take_b)
+          remap_b[j++] = values.size() - 1;
+      }
+      return std::make_shared<const StringDictionary>(values);
+    }
+
+  private:
+    std::string arena;
+    std::vector<size_t> offsets{0};
+  };
+
+  // Dictionary-encoded string column: one int32 code per row into a
+  // dictionary that columns derived from it (take, sort_by) share. Sorts,
+  // inequality and equality comparisons run on the codes; two columns
+  // compare by code directly once they share a dictionary.
+  struct DictionaryColumn
+  {
+    using value_type = std::string_view;
+
+    std::shared_ptr<const StringDictionary> dictionary;
+    ColumnVector<int32_t> codes;
+
+    template <typename Strings>
+    static DictionaryColumn encode(const Strings &values)
+    {
+      std::vector<std::string_view> distinct(values.begin(), values.end());
+      parallel_sort(distinct, std::less<>(), parallel_sort_threshold);
+      distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+      if (distinct.size() > size_t(std::numeric_limits<int32_t>::max()))
+        throw(std::overflow_error("too many distinct values for int32 codes"));
+      DictionaryColumn column{std::make_shared<const StringDictionary>(distinct),
+                              ColumnVector<int32_t>(values.size())};
+      parallel_for(0, values.size(), parallel_grain, [&](size_t lo, size_t hi)
+                   {
+        for (size_t i = lo; i < hi; ++i)
+          column.codes[i] = column.dictionary->lower_bound(values[i]); });
+      return column;
+    }
+
+    [[nodiscard]] size_t size() const { return codes.size(); }
+
+    std::string_view operator[](size_t row) const { return (*dictionary)[codes[row]]; }
+
+    // the given rows, in that order, on the same dictionary
+    DictionaryColumn take(const std::vector<size_t> &rows) const
+    {
+      DictionaryColumn column{dictionary, ColumnVector<int32_t>(rows.size())};
+      parallel_for(0, rows.size(), parallel_grain, [&](size_t lo, size_t hi)
+                   {
+        for (size_t i = lo; i < hi; ++i)
+          column.codes[i] = codes[rows[i]]; });
+      return column;
+    }
+
+    // the same strings coded in dictionary, a superset of the current one
+    // whose codes are given by remap
+    DictionaryColumn recode(std::shared_ptr<const StringDictionary> target,
+                            const std::vector<int32_t> &remap) const
+    {
+      DictionaryColumn column{std::move(target), ColumnVector<int32_t>(size())};
+      parallel_for(0, size(), parallel_grain, [&](size_t lo, size_t hi)
+                   {
+        for (size_t i = lo; i < hi; ++i)
+          column.codes[i] = remap[codes[i]]; });
+      return column;
+    }
+  };
+
+  // Values of a typed column, one alternative per ArrowType in the order of
+  // the enum, so that index() is the column's ArrowType. BOOL is one byte
+  // per value.
+  using TypedValues = std::variant<ColumnVector<int32_t>, ColumnVector<int64_t>,
+                                   ColumnVector<float>, ColumnVector<double>,
+                                   DictionaryColumn, ColumnVector<uint8_t>>;
+
+  struct TypedColumn
+  {
+    TypedValues values;
+    Validity validity; // NULLs, nullptr when there are none
+
+    [[nodiscard]] ArrowType type() const { return static_cast<ArrowType>(values.index()); }
+
+    [[nodiscard]] size_t size() const
+    {
+      return std::visit([](const auto &v)
+                        { return v.size(); },
+                        values);
+    }
+  };
+
+  inline bool is_numeric(ArrowType type)
+  {
+    return type != ArrowType::STRING && type != ArrowType::BOOL;
+  }
+
+  // Dataframe whose columns each have their own type under one Schema.
+  // Every column is a contiguous native buffer (strings dictionary encoded,
+  // see DictionaryColumn); sorts and joins dispatch once per column to a kernel for
+  // its type instead of visiting a variant per cell.
+  class TypedDataframe
+  {
+  public:
+    explicit TypedDataframe(size_t length = 0) : length(length) {}
+
+    [[nodiscard]] size_t num_rows() const { return length; }
+
+    [[nodiscard]] size_t num_cols() const { return columns.size(); }
+
+    [[nodiscard]] const Schema &schema() const { return schema_; }
+
+    size_t col_index(const std::string &col) const
+    {
+      auto item = index.find(col);
+      if (item != index.end())
+      {
+        return item->second;
+      }
+      throw std::runtime_error("Column not found");
+    }
+
+    const TypedColumn &get_column(size_t i) const
+    {
+      if (i < columns.size())
+        return columns[i];
+      throw(std::out_of_range("the index \'" + std::to_string(i) +
+                              "\' is out of range!"));
+    }
+
+    // values of column i, which must hold Values
+    template <typename Values>
+    const Values &values(size_t i) const
+    {
+      const auto *values = std::get_if<Values>(&get_column(i).values);
+      if (values == nullptr)
+        throw(std::invalid_argument("column " + schema_.fields[i].name +
+                                    " has another type"));
+      return *values;
+    }
+
+    // add a column, or replace the one of the same name
+    void insert(const std::string &col, TypedValues values, Validity validity = nullptr)
+    {
+      TypedColumn column{std::move(values), std::move(validity)};
+      if (column.size() != length ||
+          (column.validity && column.validity->size() != length))
+        throw(std::invalid_argument("The length of the two is not the same"));
+      auto item = index.find(col);
+      if (item != index.end())
+      {
+        schema_.fields[item->second].dataType = column.type();
+        columns[item->second] = std::move(column);
+        return;
+      }
+      index.emplace(col, columns.size());
+      schema_.fields.emplace_back(col, column.type());
+      columns.push_back(std::move(column));
+    }
+
+    template <typename T>
+    void insert(const std::string &col, const std::vector<T> &values,
+                Validity validity = nullptr)
+    {
+      if constexpr (std::is_same_v<T, std::string>)
+        insert(col, TypedValues(DictionaryColumn::encode(values)), std::move(validity));
+      else if constexpr (std::is_same_v<T, bool>)
+        insert(col, TypedValues(ColumnVector<uint8_t>(values.begin(), values.end())),
+               std::move(validity));
+      else
+        insert(col, TypedValues(ColumnVector<T>(values.begin(), values.end())),
+               std::move(validity));
+    }
+
+    // read a csv file with a header line; every column gets the narrowest
+    // of INT32, INT64, DOUBLE and STRING that holds all its values, empty
+    // fields are NULL
+    void read_csv(std::string_view filename, const char &delimiter = ',')
+    {
+      CsvOptions options;
+      options.delimiter = delimiter;
+      read_csv(filename, options);
+    }
+
+    // read the columns of options.columns only; the columns of
+    // options.types get that type without inference, fields that are not
+    // of it are NULL
+    void read_csv(std::string_view filename, const CsvOptions &options)
+    {
+      MappedFile file{std::string(filename)};
+      const char *end = file.end();
+      std::vector<std::string_view> fields;
+      const char *cursor = split_csv_row(file.begin(), end, options.delimiter, fields);
+      size_t num_fields = fields.size();
+      std::vector<std::string> names;
+      std::vector<size_t> selected;
+      for (size_t f = 0; f < num_fields; ++f)
+      {
+        std::string name = unquote(fields[f]);
+        if (options.columns.empty() ||
+            std::find(options.columns.begin(), options.columns.end(), name) !=
+                options.columns.end())
+        {
+          names.push_back(std::move(name));
+          selected.push_back(f);
+        }
+      }
+      if (names.size() < options.columns.size())
+        throw std::runtime_error("Column not found");
+
+      // fields of the selected columns, viewed in the mapping
+      std::vector<std::vector<std::string_view>> cells(names.size());
+      size_t rows = 0;
+      while (cursor < end)
+      {
+        cursor = split_csv_row(cursor, end, options.delimiter, fields);
+        if (fields.size() != num_fields || (num_fields == 1 && fields[0].empty()))
+          continue;
+        for (size_t c = 0; c < names.size(); ++c)
+          cells[c].push_back(fields[selected[c]]);
+        rows++;
+      }
+
+      *this = TypedDataframe(rows);
+      std::vector<TypedValues> parsed(names.size());
+      std::vector<Validity> validity(names.size());
+      parallel_for(0, names.size(), 1, [&](size_t lo, size_t hi)
+                   {
+        for (size_t c = lo; c < hi; ++c)
+        {
+          auto type = options.types.find(names[c]);
+          parsed[c] = parse_column(cells[c],
+                                   type == options.types.end() ? infer_type(cells[c]) : type->second,
+                                   validity[c]);
+        } });
+      for (size_t c = 0; c < names.size(); ++c)
+      {
+        insert(names[c], std::move(parsed[c]), std::move(validity[c]));
+      }
+    }
+
+    // new frame made of the given rows, in that order
+    TypedDataframe take(const std::vector<size_t> &rows) const
+    {
+      TypedDataframe result(rows.size());
+      for (size_t c = 0; c < columns.size(); ++c)
+      {
+        result.insert(schema_.fields[c].name, std::visit([&](const auto &source)
+                                                         {
+          using Values = std::decay_t<decltype(source)>;
+          if constexpr (std::is_same_v<Values, DictionaryColumn>)
+          {
+            return TypedValues(source.take(rows));
+          }
+          else
+          {
+            Values target(rows.size());
+            parallel_for(0, rows.size(), parallel_grain, [&](size_t lo, size_t hi)
+                         {
+              for (size_t i = lo; i < hi; ++i)
+                target[i] = source[rows[i]]; });
+            return TypedValues(std::move(target));
+          } },
+                                                         columns[c].values),
+                      columns[c].validity ? std::make_shared<const ValidityBitmap>(
+                                                columns[c].validity->take(rows))
+                                          : nullptr);
+      }
+      return result;
+    }
+
+    // sort lexicographically by several columns, each in its own direction;
+    // rows equal on every key keep their order
+    TypedDataframe sort_by(const std::vector<SortKey> &keys) const
+    {
+      // one normalized uint64 column per key, from the kernel of its type,
+      // after a NULL flag column for keys with NULLs
+      std::vector<ColumnVector<uint64_t>> normalized;
+      for (const auto &key : keys)
+      {
+        const TypedColumn &column = get_column(col_index(key.column));
+        normalized.push_back(normalize(column, key.descending));
+        if (!column.validity)
+          continue;
+        ColumnVector<uint64_t> flags(length);
+        for (size_t i = 0; i < length; ++i)
+        {
+          bool valid = column.validity->valid(i);
+          flags[i] = valid == key.nulls_first;
+          if (!valid)
+            normalized.back()[i] = 0;
+        }
+        normalized.insert(normalized.end() - 1, std::move(flags));
+      }
+      auto key = [&](size_t k, size_t i)
+      { return normalized[k][i]; };
+      switch (normalized.size())
+      {
+      case 1:
+        return take(packed_sort_rows<1>(length, key));
+      case 2:
+        return take(packed_sort_rows<2>(length, key));
+      case 3:
+        return take(packed_sort_rows<3>(length, key));
+      case 4:
+        return take(packed_sort_rows<4>(length, key));
+      }
+      std::vector<size_t> rows(length);
+      std::iota(rows.begin(), rows.end(), 0);
+      parallel_sort(rows, [&](size_t a, size_t b)
+                    {
+        for (const auto &column : normalized)
+        {
+          if (column[a] != column[b])
+            return column[a] < column[b];
+        }
+        return a < b; },
+                    parallel_sort_threshold);
+      return take(rows);
+    }
+
+    TypedDataframe sort_by(const std::string &column_name, bool descending = false) const
+    {
+      return sort_by({SortKey{column_name, descending}});
+    }
+
+    // Order-preserving int32 codes of a column: the rank of every value
+    // among the distinct values of the column, so sorts and comparisons on
+    // the codes agree with the values.
+    [[nodiscard]] std::vector<int32_t> ranks(size_t i) const
+    {
+      return std::visit([](const auto &values)
+                        { return rank_encode(values, values).first; },
+                        get_column(i).values);
+    }
+
+    // Make column lhs of T and column rhs of Tr, both strings, share one
+    // dictionary, so that later joins compare their codes as they are.
+    static void share_dictionary(TypedDataframe &T, const std::string &lhs,
+                                 TypedDataframe &Tr, const std::string &rhs)
+    {
+      const auto &left = T.values<DictionaryColumn>(T.col_index(lhs));
+      const auto &right = Tr.values<DictionaryColumn>(Tr.col_index(rhs));
+      if (left.dictionary == right.dictionary)
+        return;
+      std::vector<int32_t> remap_left, remap_right;
+      auto dictionary = StringDictionary::merge(*left.dictionary, *right.dictionary,
+                                                remap_left, remap_right);
+      // the NULLs stay NULL: their codes are recoded, not their validity
+      Validity left_validity = T.get_column(T.col_index(lhs)).validity;
+      Validity right_validity = Tr.get_column(Tr.col_index(rhs)).validity;
+      T.insert(lhs, TypedValues(left.recode(dictionary, remap_left)), left_validity);
+      Tr.insert(rhs, TypedValues(right.recode(dictionary, remap_right)), right_validity);
+    }
+
+    // Codes of two string columns that compare like their strings: the
+    // codes themselves when they share a dictionary, else codes in the
+    // merge of both dictionaries.
+    static std::pair<std::vector<int32_t>, std::vector<int32_t>>
+    rank_encode(const DictionaryColumn &left, const DictionaryColumn &right)
+    {
+      if (left.dictionary == right.dictionary)
+        return {std::vector<int32_t>(left.codes.begin(), left.codes.end()),
+                std::vector<int32_t>(right.codes.begin(), right.codes.end())};
+      std::vector<int32_t> remap_left, remap_right;
+      auto dictionary = StringDictionary::merge(*left.dictionary, *right.dictionary,
+                                                remap_left, remap_right);
+      auto recode = [](const DictionaryColumn &column, const std::vector<int32_t> &remap)
+      {
+        std::vector<int32_t> codes(column.size());
+        parallel_for(0, codes.size(), parallel_grain, [&](size_t lo, size_t hi)
+                     {
+          for (size_t i = lo; i < hi; ++i)
+            codes[i] = remap[column.codes[i]]; });
+        return codes;
+      };
+      return {recode(left, remap_left), recode(right, remap_right)};
+    }
+
+    // Rank-encode two sequences over the union of their distinct values:
+    // a < b, a == b between the sides hold exactly when they hold between
+    // the codes.
+    template <typename A, typename B>
+    static std::pair<std::vector<int32_t>, std::vector<int32_t>>
+    rank_encode(const A &left, const B &right)
+    {
+      using Value = std::common_type_t<typename A::value_type, typename B::value_type>;
+      std::vector<Value> distinct(left.begin(), left.end());
+      distinct.insert(distinct.end(), right.begin(), right.end());
+      parallel_sort(distinct, std::less<>(), parallel_sort_threshold);
+      distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+      if (distinct.size() > size_t(std::numeric_limits<int32_t>::max()))
+        throw(std::overflow_error("too many distinct values for int32 codes"));
+      auto encode = [&](const auto &values)
+      {
+        std::vector<int32_t> codes(values.size());
+        parallel_for(0, values.size(), parallel_grain, [&](size_t lo, size_t hi)
+                     {
+          for (size_t i = lo; i < hi; ++i)
+            codes[i] = std::lower_bound(distinct.begin(), distinct.end(),
+                                        Value(values[i])) -
+                       distinct.begin(); });
+        return codes;
+      };
+      return {encode(left), encode(right)};
+    }
+
+  private:
+    template <typename Value>
+    static bool parse(std::string_view cell, Value &value)
+    {
+      if (!cell.empty() && cell[0] == '+')
+        cell.remove_prefix(1);
+      auto [end, error] = std::from_chars(cell.data(), cell.data() + cell.size(), value);
+      return error == std::errc() && end == cell.data() + cell.size();
+    }
+
+    // the narrowest of INT32, INT64, DOUBLE and STRING that holds all the
+    // non-empty cells
+    static ArrowType infer_type(const std::vector<std::string_view> &cells)
+    {
+      bool fits_int64 = true, fits_int32 = true;
+      for (const auto &cell : cells)
+      {
+        if (cell.empty())
+          continue;
+        int64_t integer;
+        double real;
+        if (fits_int64 && parse(cell, integer))
+        {
+          fits_int32 &= integer >= std::numeric_limits<int32_t>::min() &&
+                        integer <= std::numeric_limits<int32_t>::max();
+          continue;
+        }
+        fits_int64 = fits_int32 = false;
+        if (!parse(cell, real))
+          return ArrowType::STRING;
+      }
+      return fits_int32 ? ArrowType::INT32 : fits_int64 ? ArrowType::INT64 : ArrowType::DOUBLE;
+    }
+
+    // the cells as values of type; empty cells and cells that are not of
+    // the type are NULL, marked in validity
+    static TypedValues parse_column(const std::vector<std::string_view> &cells, ArrowType type,
+                                    Validity &validity)
+    {
+      ValidityBitmap valid(cells.size());
+      auto convert = [&](auto values)
+      {
+        std::vector<uint8_t> parsed(cells.size());
+        parallel_for(0, cells.size(), parallel_grain, [&](size_t lo, size_t hi)
+                     {
+          for (size_t i = lo; i < hi; ++i)
+          {
+            parsed[i] = parse(cells[i], values[i]);
+            if (!parsed[i])
+              values[i] = 0;
+          } });
+        for (size_t i = 0; i < cells.size(); ++i)
+        {
+          if (!parsed[i])
+            valid.set(i, false);
+        }
+        return TypedValues(std::move(values));
+      };
+      TypedValues values;
+      switch (type)
+      {
+      case ArrowType::INT32:
+        values = convert(ColumnVector<int32_t>(cells.size()));
+        break;
+      case ArrowType::INT64:
+        values = convert(ColumnVector<int64_t>(cells.size()));
+        break;
+      case ArrowType::FLOAT:
+        values = convert(ColumnVector<float>(cells.size()));
+        break;
+      case ArrowType::DOUBLE:
+        values = convert(ColumnVector<double>(cells.size()));
+        break;
+      case ArrowType::BOOL:
+      {
+        ColumnVector<uint8_t> flags(cells.size(), 0);
+        for (size_t i = 0; i < cells.size(); ++i)
+        {
+          if (cells[i] == "true" || cells[i] == "1")
+            flags[i] = 1;
+          else if (cells[i] != "false" && cells[i] != "0")
+            valid.set(i, false);
+        }
+        values = TypedValues(std::move(flags));
+        break;
+      }
+      case ArrowType::STRING:
+      {
+        std::vector<std::string> strings;
+        strings.reserve(cells.size());
+        for (size_t i = 0; i < cells.size(); ++i)
+        {
+          strings.push_back(unquote(cells[i]));
+          if (cells[i].empty())
+            valid.set(i, false);
+        }
+        values = TypedValues(DictionaryColumn::encode(strings));
+        break;
+      }
+      }
+      if (valid.null_count() > 0)
+        validity = std::make_shared<const ValidityBitmap>(std::move(valid));
+      return values;
+    }
+
+    // normalized sort keys of a column: numbers map directly, strings map
+    // through their dictionary codes
+    static ColumnVector<uint64_t> normalize(const TypedColumn &column, bool descending)
+    {
+      return std::visit([&](const auto &values)
+                        {
+        ColumnVector<uint64_t> keys(values.size());
+        using Value = typename std::decay_t<decltype(values)>::value_type;
+        if constexpr (std::is_same_v<Value, std::string_view>)
+        {
+          parallel_for(0, values.size(), parallel_grain, [&](size_t lo, size_t hi)
+                       {
+            for (size_t i = lo; i < hi; ++i)
+              keys[i] = normalized_key(values.codes[i], descending); });
+        }
+        else
+        {
+          parallel_for(0, values.size(), parallel_grain, [&](size_t lo, size_t hi)
+                       {
+            for (size_t i = lo; i < hi; ++i)
+              keys[i] = normalized_key(values[i], descending); });
+        }
+        return keys; },
+                        column.values);
+    }
+
+    Schema schema_{{}};
+    std::unordered_map<std::string, size_t> index;
+    std::vector<TypedColumn> columns;
+    size_t length = 0;
+  };
+} // namespace frame
+#endif // TYPED_DATAFRAME_H
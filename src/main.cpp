@@ -1,16 +1,22 @@
+#include <filesystem>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "dataframe/columnar_file.h"
 #include "dataframe/dataframe.h"
+#include "dataframe/external_iejoin.h"
 #include "dataframe/iejoin.h"
+#include "dataframe/result_file.h"
+#include "dataframe/shm_iejoin.h"
 
 void distributed_iejoin_employees(std::string_view csv_file_path) {
 
   // create an empty Dataframe object
   DataFrame employees;
-  // recreate a Dataframe object from csv file or another
-  employees.read_csv(csv_file_path);
+  // recreate a Dataframe object from the columns of the csv file the join uses
+  employees.read_csv(csv_file_path, frame::CsvOptions{',', {"salary", "tax"}, {}});
 
   //  std::cout << employees << std::endl;
 
@@ -25,12 +31,80 @@ void distributed_iejoin_employees(std::string_view csv_file_path) {
   std::cerr << "ScalableIEJoin.sz: " << actual.size() << std::endl;
 }
 
+void multiprocess_iejoin_employees(std::string_view csv_file_path) {
+  DataFrame employees;
+  employees.read_csv(csv_file_path, frame::CsvOptions{',', {"salary", "tax"}, {}});
+
+  std::vector<Predicate> preds = {{"op1", kOperator::kLess, "salary", "salary"},
+                                  {"op2", kOperator::kGreater, "tax", "tax"}};
+
+  auto actual = DistributedIEJoin(employees, employees, preds);
+  std::cerr << "DistributedIEJoin.sz: " << actual.size() << std::endl;
+}
+
+// the pairs go to result_path as a join result file when it is given
+void external_iejoin_employees(std::string_view csv_file_path,
+                               std::string_view result_path) {
+  DataFrame employees;
+  employees.read_csv(csv_file_path, frame::CsvOptions{',', {"salary", "tax"}, {}});
+
+  std::vector<Predicate> preds = {{"op1", kOperator::kLess, "salary", "salary"},
+                                  {"op2", kOperator::kGreater, "tax", "tax"}};
+
+  size_t num_pairs = 0;
+  std::unique_ptr<ResultWriter> writer;
+  if (!result_path.empty()) {
+    writer = std::make_unique<ResultWriter>(std::string(result_path));
+  }
+  ExternalJoinOptions options;
+  options.memory_budget = size_t(64) << 20;
+  SpillStats stats = ExternalIEJoin(
+      employees, employees, preds,
+      [&](const std::vector<std::pair<int, int>> &batch) {
+        num_pairs += batch.size();
+        if (writer) {
+          writer->write(batch);
+        }
+      },
+      options);
+  std::cerr << "ExternalIEJoin.sz: " << num_pairs << std::endl;
+  if (writer) {
+    writer->close();
+    std::cerr << "result file: " << writer->bytes() << " bytes" << std::endl;
+  }
+  std::cerr << "spill: written " << stats.bytes_written << " bytes, read "
+            << stats.bytes_read << " bytes, " << stats.runs << " runs, "
+            << stats.partitions << " partitions, " << stats.partition_pairs
+            << " partition pairs" << std::endl;
+}
+
+void columnar_iejoin_employees(std::string_view csv_file_path) {
+  // parse the csv into a columnar file next to it when that one is missing
+  // or older, later runs only map it
+  std::string columnar_path = std::string(csv_file_path) + ".col";
+  if (!std::filesystem::exists(columnar_path) ||
+      std::filesystem::last_write_time(columnar_path) <
+          std::filesystem::last_write_time(csv_file_path)) {
+    DataFrame employees;
+    employees.read_csv(csv_file_path, frame::CsvOptions{',', {"salary", "tax"}, {}});
+    frame::write_columnar(employees, columnar_path);
+  }
+  DataFrameView employees = frame::open_columnar<DataType>(columnar_path);
+
+  std::vector<Predicate> preds = {{"op1", kOperator::kLess, "salary", "salary"},
+                                  {"op2", kOperator::kGreater, "tax", "tax"}};
+
+  auto actual = IESelfJoin(employees, preds, 0);
+  std::cerr << "columnar IESelfJoin.sz: " << actual.size() << std::endl;
+}
+
 void distributed_loop_join_employees(std::string_view filename) {
 
   // create an empty Dataframe object
   DataFrame employees;
-  // recreate a Dataframe object from csv file or another
-  employees.read_csv(filename);
+  // recreate a Dataframe object from the columns of the csv file the join
+  // uses; the loop join takes its row ids from the first one
+  employees.read_csv(filename, frame::CsvOptions{',', {"id", "salary", "tax"}, {}});
 
   //  std::cout << employees << std::endl;
 
@@ -51,16 +125,23 @@ int main(int argc, char *argv[]) {
 
 
    // print the other arguments
-   if (argc == 2 || argc == 3) {
+   if (argc >= 2 && argc <= 4) {
      std::cout << "filename "  << ": " << argv[1] << std::endl;
      std::string_view csv_file_path = argv[1];
-     std::string_view test_name = argc == 3 ? argv[2] : "distributed_iejoin_employees";
+     std::string_view test_name = argc >= 3 ? argv[2] : "distributed_iejoin_employees";
+     std::string_view result_path = argc == 4 ? argv[3] : "";
      std::cout << "test_name "  << ": " << test_name << std::endl;
      if (csv_file_path.find(".csv") != std::string::npos){
       if (test_name == "iejoin") {
           test_iejoin_employees(csv_file_path);
       } else if (test_name == "distributed_iejoin") {
           distributed_iejoin_employees(csv_file_path);
+      } else if (test_name == "multiprocess_iejoin") {
+          multiprocess_iejoin_employees(csv_file_path);
+      } else if (test_name == "external_iejoin") {
+          external_iejoin_employees(csv_file_path, result_path);
+      } else if (test_name == "columnar_iejoin") {
+          columnar_iejoin_employees(csv_file_path);
       } else if (test_name == "distributed_loop_join_employees"){
           distributed_loop_join_employees(csv_file_path);
       } else {
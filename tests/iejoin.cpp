@@ -1,14 +1,26 @@
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <sstream>
 
 #include <map>
+#include <numeric>
 #include <string>
 #include <tuple>
 #include <vector>
 
+#include "dataframe/arrow_c_data.h"
+#include "dataframe/columnar_file.h"
 #include "dataframe/dataframe.h"
+#include "dataframe/external_iejoin.h"
 #include "dataframe/iejoin.h"
+#include "dataframe/result_file.h"
+#include "dataframe/shm_iejoin.h"
 
 void test_west() {
   std::vector<std::map<std::string, int>> west_dict = {{{{"row_index", 0},
@@ -85,6 +97,46 @@ void distributed_iejoin_sample() {
   }
 }
 
+// (rid, x, y) frame with row_index as the id column expected by LoopJoin
+DataFrame make_xy(const std::vector<int> &x, const std::vector<int> &y) {
+  DataFrame table = DataFrame::create_empty_dataframe(x.size());
+  table.create_row_index();
+  table.insert("x", x);
+  table.insert("y", y);
+  return table;
+}
+
+std::vector<std::pair<int, int>>
+sorted_pairs(const std::vector<std::tuple<int, int>> &pairs) {
+  std::vector<std::pair<int, int>> result;
+  for (const auto &[l, r] : pairs) {
+    result.emplace_back(l, r);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+std::vector<std::pair<int, int>>
+sorted_pairs(std::vector<std::pair<int, int>> pairs) {
+  std::sort(pairs.begin(), pairs.end());
+  return pairs;
+}
+
+// the scheduler with num_workers workers for the scope of a test, then the
+// worker count it had before, which the other tests run with
+class ScopedWorkers {
+public:
+  explicit ScopedWorkers(size_t num_workers)
+      : previous(frame::TaskScheduler::instance().num_workers()) {
+    frame::TaskScheduler::configure(num_workers);
+  }
+
+  ~ScopedWorkers() { frame::TaskScheduler::configure(previous); }
+
+private:
+  size_t previous;
+};
+
 TEST(MyClassTest, test_west) {
   test_west();
   EXPECT_EQ(2, 1 + 1);
@@ -96,6 +148,1178 @@ TEST(MyClassTest, distributed_iejoin_sample) {
 }
 
 
+TEST(MyClassTest, self_join_mirrored) {
+  DataFrame T = make_xy({3, 1, 4, 1, 5, 9, 2, 6, 5, 3},
+                        {2, 7, 1, 8, 2, 8, 1, 8, 2, 8});
+  const std::vector<std::pair<kOperator, kOperator>> shapes = {
+      {kLess, kGreater}, {kLessEqual, kGreaterEqual}, {kLess, kGreaterEqual}};
+  for (const auto &[op1, op2] : shapes) {
+    std::vector<Predicate> preds = {{"op1", op1, "x", "x"}, {"op2", op2, "y", "y"}};
+    std::vector<Predicate> mirror = {{"op1", FlipOperator(op1), "x", "x"},
+                                     {"op2", FlipOperator(op2), "y", "y"}};
+    auto expected = sorted_pairs(LoopJoin(T, T, preds));
+    EXPECT_EQ(expected, sorted_pairs(IESelfJoin(T, preds)));
+
+    auto both = expected;
+    for (const auto &pair : sorted_pairs(LoopJoin(T, T, mirror))) {
+      if (!std::binary_search(expected.begin(), expected.end(), pair)) {
+        both.push_back(pair);
+      }
+    }
+    EXPECT_EQ(sorted_pairs(both), sorted_pairs(IESelfJoin(T, preds, 0, true)));
+  }
+
+  std::vector<Predicate> symmetric = {{"op1", kLessEqual, "x", "x"},
+                                      {"op2", kGreaterEqual, "x", "x"}};
+  EXPECT_EQ(kSymmetric, DetectSymmetry(symmetric));
+  EXPECT_EQ(sorted_pairs(LoopJoin(T, T, symmetric)),
+            sorted_pairs(IESelfJoin(T, symmetric)));
+
+  // != is symmetric by itself, but no shortcut applies to it
+  DataFrame U = make_xy({1, 2, 3, 4}, {2, 2, 1, 1});
+  std::vector<Predicate> not_equal = {{"op1", kNotEqual, "x", "x"},
+                                      {"op2", kNotEqual, "x", "x"}};
+  EXPECT_EQ(kAsymmetric, DetectSymmetry(not_equal));
+  EXPECT_EQ(12u, IESelfJoin(U, not_equal).size());
+  EXPECT_EQ(sorted_pairs(LoopJoin(U, U, not_equal)),
+            sorted_pairs(IESelfJoin(U, not_equal)));
+  EXPECT_EQ(sorted_pairs(LoopJoin(U, U, not_equal)),
+            sorted_pairs(IESelfJoin(U, not_equal, 0, true)));
+  std::vector<Predicate> less_not_equal = {{"op1", kLessEqual, "x", "x"},
+                                           {"op2", kNotEqual, "y", "y"}};
+  EXPECT_EQ(kAsymmetric, DetectSymmetry(less_not_equal));
+  auto expected = sorted_pairs(LoopJoin(U, U, less_not_equal));
+  EXPECT_EQ(expected, sorted_pairs(IESelfJoin(U, less_not_equal)));
+  auto both = expected;
+  for (const auto &[l, r] : expected) {
+    both.emplace_back(r, l);
+  }
+  std::sort(both.begin(), both.end());
+  both.erase(std::unique(both.begin(), both.end()), both.end());
+  EXPECT_EQ(both, sorted_pairs(IESelfJoin(U, less_not_equal, 0, true)));
+}
+
+TEST(MyClassTest, iejoin_duplicate_keys) {
+  // low-cardinality keys: long runs of equal values in L1 and L2
+  DataFrame T = make_xy({2, 1, 2, 0, 1, 2, 2, 0, 1, 1, 2, 0},
+                        {1, 1, 0, 1, 2, 1, 1, 0, 2, 2, 0, 1});
+  DataFrame Tr = make_xy({1, 2, 0, 1, 1, 2, 0}, {0, 1, 1, 2, 1, 0, 2});
+  const std::vector<kOperator> ops = {kLess, kLessEqual, kGreater, kGreaterEqual};
+  for (auto op1 : ops) {
+    for (auto op2 : ops) {
+      std::vector<Predicate> preds = {{"op1", op1, "x", "x"},
+                                      {"op2", op2, "y", "y"}};
+      EXPECT_EQ(sorted_pairs(LoopJoin(T, T, preds)),
+                sorted_pairs(IESelfJoin(T, preds)));
+      EXPECT_EQ(sorted_pairs(LoopJoin(T, Tr, preds)),
+                sorted_pairs(IEJoin(T, Tr, preds)));
+    }
+  }
+}
+
+TEST(MyClassTest, iejoin_range_output) {
+  DataFrame T = make_xy({2, 1, 2, 0, 1, 2, 2, 0, 1, 1, 2, 0},
+                        {1, 1, 0, 1, 2, 1, 1, 0, 2, 2, 0, 1});
+  DataFrame Tr = make_xy({1, 2, 0, 1, 1, 2, 0}, {0, 1, 1, 2, 1, 0, 2});
+  const std::vector<kOperator> ops = {kLess, kLessEqual, kGreater, kGreaterEqual};
+  for (auto op1 : ops) {
+    for (auto op2 : ops) {
+      std::vector<Predicate> preds = {{"op1", op1, "x", "x"},
+                                      {"op2", op2, "y", "y"}};
+      auto self_runs = IESelfJoinRanges(T, preds);
+      EXPECT_EQ(sorted_pairs(IESelfJoin(T, preds)),
+                sorted_pairs(self_runs.expand()));
+      EXPECT_EQ(self_runs.num_pairs(), self_runs.expand().size());
+      EXPECT_EQ(sorted_pairs(IEJoin(T, Tr, preds)),
+                sorted_pairs(IEJoinRanges(T, Tr, preds).expand()));
+    }
+  }
+
+  // != runs are those of < and of >, over two tables
+  for (auto op2 : ops) {
+    std::vector<Predicate> preds = {{"op1", kNotEqual, "x", "x"},
+                                    {"op2", op2, "y", "y"}};
+    EXPECT_EQ(sorted_pairs(IESelfJoin(T, preds)),
+              sorted_pairs(IESelfJoinRanges(T, preds).expand()));
+  }
+
+  // dominance: every row matches all rows with larger keys in one run
+  std::vector<int> keys(64);
+  std::iota(keys.begin(), keys.end(), 0);
+  DataFrame D = make_xy(keys, keys);
+  std::vector<Predicate> dominance = {{"op1", kLess, "x", "x"},
+                                      {"op2", kLess, "y", "y"}};
+  auto runs = IESelfJoinRanges(D, dominance);
+  EXPECT_EQ(64u * 63u / 2u, runs.num_pairs());
+  EXPECT_EQ(63u, runs.runs.size());
+}
+
+TEST(MyClassTest, iejoin_aggregate) {
+  DataFrame T = make_xy({2, 1, 2, 0, 1, 2, 2, 0, 1, 1, 2, 0},
+                        {1, 1, 0, 1, 2, 1, 1, 0, 2, 2, 0, 1});
+  DataFrame Tr = make_xy({1, 2, 0, 1, 1, 2, 0}, {0, 1, 1, 2, 1, 0, 2});
+  const std::vector<kOperator> ops = {kLess, kLessEqual, kGreater, kGreaterEqual};
+  // aggregate x of the matching rows, computed from the pairs
+  auto aggregate_pairs = [](const std::vector<std::pair<int, int>> &pairs,
+                            const DataFrame &right, size_t m) {
+    std::vector<JoinAggregate> expected(m);
+    for (size_t r = 0; r < m; ++r) {
+      expected[r].row_id = r;
+    }
+    for (const auto &[l, r] : pairs) {
+      expected[l].add(right.get_column(right.col_index("x"))[r]);
+    }
+    return expected;
+  };
+  auto expect_equal = [](const std::vector<JoinAggregate> &expected,
+                         const std::vector<JoinAggregate> &actual) {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t r = 0; r < expected.size(); ++r) {
+      EXPECT_EQ(expected[r].row_id, actual[r].row_id);
+      EXPECT_EQ(expected[r].count, actual[r].count);
+      EXPECT_EQ(expected[r].sum, actual[r].sum);
+      if (expected[r].count > 0) {
+        EXPECT_EQ(expected[r].min, actual[r].min);
+        EXPECT_EQ(expected[r].max, actual[r].max);
+      }
+    }
+  };
+  for (auto op1 : ops) {
+    for (auto op2 : ops) {
+      std::vector<Predicate> preds = {{"op1", op1, "x", "x"},
+                                      {"op2", op2, "y", "y"}};
+      expect_equal(aggregate_pairs(IESelfJoin(T, preds), T, T.num_rows()),
+                   IESelfJoinAggregate(T, preds, "x"));
+      expect_equal(aggregate_pairs(IEJoin(T, Tr, preds), Tr, T.num_rows()),
+                   IEJoinAggregate(T, Tr, preds, "x"));
+    }
+  }
+  std::vector<Predicate> symmetric = {{"op1", kLessEqual, "x", "x"},
+                                      {"op2", kGreaterEqual, "x", "x"}};
+  expect_equal(aggregate_pairs(IESelfJoin(T, symmetric), T, T.num_rows()),
+               IESelfJoinAggregate(T, symmetric, "x"));
+  for (auto op2 : ops) {
+    std::vector<Predicate> preds = {{"op1", kNotEqual, "x", "x"},
+                                    {"op2", op2, "y", "y"}};
+    expect_equal(aggregate_pairs(IESelfJoin(T, preds), T, T.num_rows()),
+                 IESelfJoinAggregate(T, preds, "x"));
+  }
+
+  // rows with a NULL key match nothing and keep the empty aggregate
+  DataFrame U = make_xy({2, 1, 0, 1}, {1, 0, 2, 1});
+  frame::ValidityBitmap nulls(4);
+  nulls.set(1, false);
+  nulls.set(2, false);
+  U.set_validity("x", std::make_shared<const frame::ValidityBitmap>(nulls));
+  std::vector<Predicate> preds = {{"op1", kGreater, "x", "x"},
+                                  {"op2", kLess, "y", "y"}};
+  auto actual = IEJoinAggregate(U, Tr, preds, "x");
+  expect_equal(aggregate_pairs(IEJoin(U, Tr, preds), Tr, U.num_rows()), actual);
+  EXPECT_EQ(actual[1].count, 0);
+  EXPECT_EQ(actual[2].count, 0);
+  expect_equal(aggregate_pairs(IESelfJoin(U, preds), U, U.num_rows()),
+               IESelfJoinAggregate(U, preds, "x"));
+}
+
+TEST(MyClassTest, adaptive_bitset) {
+  // three chunks, the last one partial
+  const size_t n = 2 * 65536 + 1000;
+  AdaptiveBitset bits(n);
+  boost::dynamic_bitset<> expected(n);
+  auto check = [&]() {
+    ASSERT_EQ(expected.count(), bits.count());
+    ASSERT_EQ(expected.find_first(), bits.find_first());
+    for (size_t p = 0; p < n; p += 97) {
+      ASSERT_EQ(expected.test(p), bits.test(p));
+      ASSERT_EQ(expected.find_next(p), bits.find_next(p));
+    }
+  };
+  check();
+  // sparse: array containers
+  for (size_t p = 5; p < n; p += 4099) {
+    bits.set(p);
+    expected.set(p);
+  }
+  check();
+  // dense first chunk: bitmap container, then full run
+  for (size_t p = 0; p < 65536; p += 3) {
+    bits.set(p);
+    expected.set(p);
+  }
+  check();
+  for (size_t p = 0; p < 65536; ++p) {
+    bits.set(p);
+    expected.set(p);
+  }
+  check();
+  // complement bit-array as in the range output: start full, then reset
+  bits.set();
+  expected.set();
+  for (size_t p = 17; p < n; p += 7) {
+    bits.reset(p);
+    expected.reset(p);
+  }
+  check();
+  bits.run_optimize();
+  check();
+
+  AdaptiveBitset sparse(1 << 24);
+  sparse.set(12345);
+  EXPECT_LT(sparse.memory_usage(), (1u << 24) / 8 / 16);
+  EXPECT_EQ(12345u, sparse.find_next(0));
+  EXPECT_EQ(AdaptiveBitset::npos, sparse.find_next(12345));
+}
+
+TEST(MyClassTest, iejoin_adaptive_bitset) {
+  DataFrame T = make_xy({2, 1, 2, 0, 1, 2, 2, 0, 1, 1, 2, 0},
+                        {1, 1, 0, 1, 2, 1, 1, 0, 2, 2, 0, 1});
+  DataFrame Tr = make_xy({1, 2, 0, 1, 1, 2, 0}, {0, 1, 1, 2, 1, 0, 2});
+  std::vector<Predicate> preds = {{"op1", kLess, "x", "x"},
+                                  {"op2", kGreaterEqual, "y", "y"}};
+  EXPECT_EQ(sorted_pairs(IESelfJoin(T, preds)),
+            sorted_pairs(IESelfJoin<AdaptiveBitset>(T, preds)));
+  EXPECT_EQ(sorted_pairs(IEJoin(T, Tr, preds)),
+            sorted_pairs(IEJoin<AdaptiveBitset>(T, Tr, preds)));
+  EXPECT_EQ(sorted_pairs(IEJoin(T, Tr, preds)),
+            sorted_pairs(IEJoinRanges<AdaptiveBitset>(T, Tr, preds).expand()));
+}
+
+TEST(MyClassTest, external_iejoin) {
+  std::vector<int> x, y, xr, yr;
+  for (int r = 0; r < 1200; ++r) {
+    x.push_back((r * 7919) % 1013);
+    y.push_back((r * 104729) % 997);
+  }
+  for (int r = 0; r < 800; ++r) {
+    xr.push_back((r * 6007) % 1009);
+    yr.push_back((r * 7727) % 983);
+  }
+  DataFrame T = make_xy(x, y);
+  DataFrame Tr = make_xy(xr, yr);
+  std::vector<Predicate> preds = {{"op1", kLess, "x", "x"},
+                                  {"op2", kGreater, "y", "y"}};
+
+  std::vector<std::pair<int, int>> actual;
+  ExternalJoinOptions options;
+  options.memory_budget = 16 << 10;
+  options.batch_size = 256;
+  SpillStats stats = ExternalIEJoin(
+      T, Tr, preds,
+      [&](const std::vector<std::pair<int, int>> &batch) {
+        EXPECT_LE(batch.size(), options.batch_size);
+        actual.insert(actual.end(), batch.begin(), batch.end());
+      },
+      options);
+
+  EXPECT_EQ(sorted_pairs(IEJoin(T, Tr, preds)), sorted_pairs(actual));
+  EXPECT_GT(stats.runs, 2u);
+  EXPECT_GT(stats.partitions, 2u);
+  EXPECT_GE(stats.bytes_written, (T.num_rows() + Tr.num_rows()) * 12);
+  EXPECT_GT(stats.bytes_read, 0u);
+
+  // spill files that are missing or cut short are errors, not short results
+  auto missing = std::filesystem::temp_directory_path() / "no-such-spill";
+  EXPECT_THROW(external::RangePartition(missing.string(), 16, stats),
+               std::runtime_error);
+  auto sorted = std::filesystem::temp_directory_path() / "short-spill";
+  std::ofstream(sorted, std::ios::binary) << "0123456789ab";
+  std::vector<int> rids;
+  EXPECT_THROW(external::LoadPartition(sorted.string(), {0, 4, 0, 0, 0, 0},
+                                       "x", "y", rids, stats),
+               std::runtime_error);
+  std::filesystem::remove(sorted);
+}
+
+TEST(MyClassTest, distributed_iejoin_processes) {
+  std::vector<int> x, y, xr, yr;
+  for (int r = 0; r < 1200; ++r) {
+    x.push_back((r * 7919) % 1013);
+    y.push_back((r * 104729) % 997);
+  }
+  for (int r = 0; r < 800; ++r) {
+    xr.push_back((r * 6007) % 1009);
+    yr.push_back((r * 7727) % 983);
+  }
+  DataFrame T = make_xy(x, y);
+  DataFrame Tr = make_xy(xr, yr);
+  std::vector<Predicate> preds = {{"op1", kGreaterEqual, "x", "x"},
+                                  {"op2", kLess, "y", "y"}};
+  DistributedOptions options;
+  options.num_workers = 3;
+  options.partition_rows = 100;
+  EXPECT_EQ(sorted_pairs(IEJoin(T, Tr, preds)),
+            sorted_pairs(DistributedIEJoin(T, Tr, preds, options)));
+}
+
+TEST(MyClassTest, task_scheduler) {
+  ScopedWorkers workers(3);
+  std::vector<long> values(100000);
+  std::iota(values.begin(), values.end(), 0);
+  std::atomic<long> total{0};
+  frame::parallel_for(0, values.size(), 1000, [&](size_t lo, size_t hi) {
+    // nested groups are helped by the waiting thread
+    frame::TaskGroup inner;
+    inner.run([&, lo, hi] {
+      total += std::accumulate(values.begin() + lo, values.begin() + hi, 0L);
+    });
+    inner.wait();
+  });
+  EXPECT_EQ(total.load(), 99999L * 100000 / 2);
+
+  frame::TaskGroup group;
+  group.run([] { throw std::runtime_error("task failed"); });
+  EXPECT_THROW(group.wait(), std::runtime_error);
+
+  std::vector<int> x, y;
+  for (int r = 0; r < 400; ++r) {
+    x.push_back((r * 7919) % 1013);
+    y.push_back((r * 104729) % 997);
+  }
+  DataFrame T = make_xy(x, y);
+  std::vector<Predicate> preds = {{"op1", kGreater, "x", "x"},
+                                  {"op2", kLess, "y", "y"}};
+  EXPECT_EQ(sorted_pairs(LoopJoin(T, T, preds)),
+            sorted_pairs(IESelfJoin(T, preds)));
+}
+
+TEST(MyClassTest, parallel_sort) {
+  ScopedWorkers workers(3);
+  std::vector<std::pair<int, size_t>> items;
+  for (size_t r = 0; r < 50000; ++r) {
+    items.emplace_back((r * 7919) % 101, r);
+  }
+  auto expected = items;
+  std::stable_sort(expected.begin(), expected.end(),
+                   [](const auto &a, const auto &b) { return a.first < b.first; });
+  frame::parallel_sort(items, std::less<>(), 0);
+  EXPECT_EQ(items, expected);
+
+  // descending sort_by keeps equal keys in row order
+  std::vector<int> x, y;
+  for (int r = 0; r < 1000; ++r) {
+    x.push_back(r % 7);
+    y.push_back(r);
+  }
+  DataFrame sorted = make_xy(x, y).sort_by("x", true);
+  const ColumnArray &xs = sorted.get_column(sorted.col_index("x"));
+  const ColumnArray &ys = sorted.get_column(sorted.col_index("y"));
+  for (size_t r = 1; r < sorted.num_rows(); ++r) {
+    EXPECT_TRUE(xs[r - 1] > xs[r] || (xs[r - 1] == xs[r] && ys[r - 1] < ys[r]));
+  }
+}
+
+TEST(MyClassTest, sort_by_columns) {
+  std::vector<int> x, y;
+  for (int r = 0; r < 2000; ++r) {
+    x.push_back((r * 7919) % 13 - 6);
+    y.push_back((r * 104729) % 17 - 8);
+  }
+  DataFrame T = make_xy(x, y);
+  DataFrame sorted = T.sort_by({{"x", false}, {"y", true}});
+  std::vector<int> expected(x.size());
+  std::iota(expected.begin(), expected.end(), 0);
+  std::stable_sort(expected.begin(), expected.end(), [&](int a, int b) {
+    return x[a] < x[b] || (x[a] == x[b] && y[a] > y[b]);
+  });
+  const ColumnArray &ids = sorted.get_column(sorted.col_index("row_index"));
+  for (size_t r = 0; r < expected.size(); ++r) {
+    EXPECT_EQ(ids[r], expected[r]);
+  }
+}
+
+TEST(MyClassTest, dataframe_views) {
+  std::vector<int> x(1000), y(1000);
+  std::iota(x.begin(), x.end(), 0);
+  std::iota(y.begin(), y.end(), 5000);
+  DataFrameView view;
+  std::vector<DataFrameView> parts;
+  {
+    DataFrame T = make_xy(x, y);
+    parts = T.partition(3);
+    view = T.select({"y"});
+    // partitions and selections share the buffers of T
+    EXPECT_EQ(parts[1].get_column(T.col_index("x")).get_buffer(),
+              T.get_column(T.col_index("x")).get_buffer());
+  }
+  ASSERT_EQ(parts.size(), 3u);
+  EXPECT_EQ(parts[0].num_rows(), 333u);
+  EXPECT_EQ(parts[2].num_rows(), 334u);
+  EXPECT_EQ(parts[1].get_column(parts[1].col_index("x"))[0], 333);
+  EXPECT_EQ(parts[2].min_max({"y"})["y"].max, 5999);
+  EXPECT_EQ(view.num_cols(), 1u);
+  EXPECT_EQ(view.slice(10, 2).get_column(0).to_vector(),
+            (std::vector<int>{5010, 5011}));
+
+  // partitions of ScalableLoopJoin are views over the projected inputs
+  std::vector<int> keys;
+  for (int r = 0; r < 1200; ++r) {
+    keys.push_back((r * 7) % 50);
+  }
+  DataFrame K = make_xy(keys, keys);
+  std::vector<Predicate> preds = {{"op1", kEqual, "x", "x"}};
+  EXPECT_EQ(sorted_pairs(ScalableLoopJoin(K, K, preds[0])),
+            sorted_pairs(LoopJoin(K, K, preds)));
+}
+
+TEST(MyClassTest, column_storage) {
+  std::vector<int> x(5000), y(5000);
+  for (int r = 0; r < 5000; ++r) {
+    x[r] = (r * 7919) % 1013;
+    y[r] = (r * 104729) % 997;
+  }
+  DataFrame T = make_xy(x, y);
+  const ColumnArray &xs = T.get_column(T.col_index("x"));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(xs.get_std_vector().data()) %
+                frame::ColumnArena::kAlignment,
+            0u);
+
+  // copies share the buffer until written to
+  DataFrame copy = T;
+  EXPECT_EQ(copy.get_column(1).get_buffer(), T.get_column(1).get_buffer());
+  // reading through a non-const frame does not copy
+  EXPECT_EQ(copy.get_column(1)[0], x[0]);
+  EXPECT_EQ(*copy.get_column(1).begin(), x[0]);
+  EXPECT_EQ(copy.get_column(1).get_buffer(), T.get_column(1).get_buffer());
+  copy.get_column(1).set(0, -1);
+  EXPECT_EQ(copy.get_column(1)[0], -1);
+  EXPECT_NE(copy.get_column(1).get_buffer(), T.get_column(1).get_buffer());
+  EXPECT_EQ(T.get_column(1)[0], x[0]);
+  // rows read through the columns, shared or not
+  DataFrame rows = T;
+  const DataFrame &const_rows = rows;
+  EXPECT_EQ(rows[3].get_std_vector(), std::vector<int>({3, x[3], y[3]}));
+  EXPECT_EQ(rows.get_row(3)[2], y[3]);
+  EXPECT_EQ(const_rows[4][1], x[4]);
+  EXPECT_EQ(const_rows.get_row(4).size(), 3u);
+  EXPECT_THROW(rows.get_row(5000), std::out_of_range);
+  EXPECT_EQ(rows.get_column(1).get_buffer(), T.get_column(1).get_buffer());
+
+  // moves hand the buffers over
+  auto buffer = copy.get_column(1).get_buffer();
+  DataFrame moved = std::move(copy);
+  EXPECT_EQ(moved.get_column(1).get_buffer(), buffer);
+
+  // repeated joins of the same shape recycle their column buffers
+  std::vector<Predicate> preds = {{"op1", kGreater, "x", "x"},
+                                  {"op2", kLess, "y", "y"}};
+  PrepareIEJoin(T, T, preds);
+  size_t allocations = frame::ColumnArena::instance().stats().system_allocations;
+  PrepareIEJoin(T, T, preds);
+  EXPECT_EQ(frame::ColumnArena::instance().stats().system_allocations,
+            allocations);
+}
+
+TEST(MyClassTest, row_cursor) {
+  DataFrame T = make_xy({1, 2, 2, 3}, {10, 20, 30, 40});
+  DataFrame Tr = make_xy({2, 3, 5}, {7, 8, 9});
+  DataFrameView view = T;
+  auto row = view.row(1);
+  EXPECT_EQ(row[view.col_index("y")], 20);
+  EXPECT_EQ((++row)[view.col_index("y")], 30);
+
+  DataFrame joined = T.cross_join(Tr, "x", "x");
+  ASSERT_EQ(joined.num_rows(), 3u);
+  EXPECT_EQ(joined.get_column(2).get_std_vector(),
+            frame::ColumnVector<int>({20, 30, 40}));
+  EXPECT_EQ(joined.get_column(5).get_std_vector(),
+            frame::ColumnVector<int>({7, 7, 8}));
+
+  EXPECT_EQ(HashJoin(T, Tr, {}).size(), 3u);
+}
+
+TEST(MyClassTest, typed_columns) {
+  auto path = std::filesystem::temp_directory_path() / "typed_columns.csv";
+  {
+    std::ofstream csv(path);
+    csv << "name,age,score,balance\n";
+    for (int r = 0; r < 300; ++r) {
+      csv << "n" << (r * 37) % 101 << "," << r % 60 << ","
+          << ((r * 53) % 97) / 4.0 << "," << 3000000000LL + r % 7 << "\n";
+    }
+  }
+  frame::TypedDataframe T;
+  T.read_csv(path.string());
+  std::filesystem::remove(path);
+  ASSERT_EQ(T.num_rows(), 300u);
+  EXPECT_EQ(T.schema().fields[0].dataType, ArrowType::STRING);
+  EXPECT_EQ(T.schema().fields[1].dataType, ArrowType::INT32);
+  EXPECT_EQ(T.schema().fields[2].dataType, ArrowType::DOUBLE);
+  EXPECT_EQ(T.schema().fields[3].dataType, ArrowType::INT64);
+  using Strings = frame::DictionaryColumn;
+  EXPECT_EQ(T.values<Strings>(0)[1], "n37");
+  EXPECT_EQ(T.values<Strings>(0).dictionary->size(), 101u);
+
+  frame::TypedDataframe sorted = T.sort_by({{"name"}, {"score", true}});
+  const auto &names = sorted.values<Strings>(0);
+  const auto &scores = sorted.values<frame::ColumnVector<double>>(2);
+  for (size_t r = 1; r < sorted.num_rows(); ++r) {
+    ASSERT_LE(names[r - 1], names[r]);
+    if (names[r - 1] == names[r]) {
+      ASSERT_GE(scores[r - 1], scores[r]);
+    }
+  }
+
+  // double against int32 and string against string, through the codes
+  std::vector<Predicate> preds = {{"op1", kLess, "score", "age"},
+                                  {"op2", kGreater, "name", "name"}};
+  frame::TypedDataframe Tr = T.take({5, 17, 42, 99, 123, 250});
+  std::vector<std::pair<int, int>> expected;
+  const auto &ages = Tr.values<frame::ColumnVector<int32_t>>(1);
+  const auto &left_scores = T.values<frame::ColumnVector<double>>(2);
+  for (size_t l = 0; l < T.num_rows(); ++l) {
+    for (size_t r = 0; r < Tr.num_rows(); ++r) {
+      if (left_scores[l] < ages[r] &&
+          T.values<Strings>(0)[l] > Tr.values<Strings>(0)[r]) {
+        expected.emplace_back(l, r);
+      }
+    }
+  }
+  EXPECT_EQ(sorted_pairs(TypedIEJoin(T, Tr, preds)), sorted_pairs(expected));
+
+  std::vector<Predicate> mixed = {{"op1", kLess, "name", "age"},
+                                  {"op2", kGreater, "score", "score"}};
+  EXPECT_THROW(TypedIEJoin(T, Tr, mixed), std::invalid_argument);
+
+  // one column in both predicates, against two partner columns
+  frame::TypedDataframe L(4), R(5);
+  L.insert("x", std::vector<double>{1.5, 3.0, 4.5, 7.0});
+  L.insert("y", std::vector<int32_t>{2, 5, 3, 8});
+  R.insert("a", std::vector<int32_t>{2, 3, 5, 8, 1});
+  R.insert("b", std::vector<double>{1.0, 3.0, 6.5, 0.5, 4.5});
+  const auto &xs = L.values<frame::ColumnVector<double>>(0);
+  const auto &ys = L.values<frame::ColumnVector<int32_t>>(1);
+  const auto &as = R.values<frame::ColumnVector<int32_t>>(0);
+  const auto &bs = R.values<frame::ColumnVector<double>>(1);
+  std::vector<Predicate> shared_lhs = {{"op1", kLess, "x", "a"},
+                                       {"op2", kGreater, "x", "b"}};
+  std::vector<Predicate> shared_rhs = {{"op1", kLessEqual, "x", "b"},
+                                       {"op2", kGreater, "y", "b"}};
+  std::vector<std::pair<int, int>> expected_lhs, expected_rhs;
+  for (int l = 0; l < 4; ++l) {
+    for (int r = 0; r < 5; ++r) {
+      if (xs[l] < as[r] && xs[l] > bs[r]) {
+        expected_lhs.emplace_back(l, r);
+      }
+      if (xs[l] <= bs[r] && ys[l] > bs[r]) {
+        expected_rhs.emplace_back(l, r);
+      }
+    }
+  }
+  EXPECT_FALSE(expected_lhs.empty());
+  EXPECT_EQ(sorted_pairs(TypedIEJoin(L, R, shared_lhs)), expected_lhs);
+  EXPECT_FALSE(expected_rhs.empty());
+  EXPECT_EQ(sorted_pairs(TypedIEJoin(L, R, shared_rhs)), expected_rhs);
+}
+
+TEST(MyClassTest, dictionary_columns) {
+  // the last row of either side is NULL
+  auto last_null = [](size_t n) {
+    frame::ValidityBitmap validity(n);
+    validity.set(n - 1, false);
+    return std::make_shared<const frame::ValidityBitmap>(std::move(validity));
+  };
+  frame::TypedDataframe T(7), Tr(5);
+  T.insert("dept", std::vector<std::string>{"ops", "dev", "hr", "dev", "qa",
+                                            "ops", ""},
+           last_null(7));
+  Tr.insert("dept", std::vector<std::string>{"dev", "art", "ops", "dev", ""},
+            last_null(5));
+  const auto &left = T.values<frame::DictionaryColumn>(0);
+  EXPECT_EQ(left.dictionary->size(), 5u);
+  EXPECT_EQ(left.dictionary->find("hr"), 2);
+  EXPECT_EQ(left.dictionary->find("art"), -1);
+  // codes order like the strings
+  EXPECT_EQ(std::vector<int>(left.codes.begin(), left.codes.end()),
+            std::vector<int>({3, 1, 2, 1, 4, 3, 0}));
+
+  Predicate eq = {"op1", kEqual, "dept", "dept"};
+  std::vector<std::pair<int, int>> expected = {{0, 2}, {1, 0}, {1, 3},
+                                               {3, 0}, {3, 3}, {5, 2}};
+  EXPECT_EQ(sorted_pairs(TypedEqualJoin(T, Tr, eq)), expected);
+
+  frame::TypedDataframe::share_dictionary(T, "dept", Tr, "dept");
+  const auto &shared = T.values<frame::DictionaryColumn>(0);
+  EXPECT_EQ(shared.dictionary, Tr.values<frame::DictionaryColumn>(0).dictionary);
+  EXPECT_EQ(shared.dictionary->size(), 6u);
+  EXPECT_EQ(shared[4], "qa");
+  ASSERT_NE(T.get_column(0).validity, nullptr);
+  ASSERT_NE(Tr.get_column(0).validity, nullptr);
+  EXPECT_FALSE(T.get_column(0).validity->valid(6));
+  EXPECT_FALSE(Tr.get_column(0).validity->valid(4));
+  EXPECT_EQ(sorted_pairs(TypedEqualJoin(T, Tr, eq)), expected);
+
+  frame::TypedDataframe sorted = T.sort_by("dept", true);
+  EXPECT_EQ(sorted.values<frame::DictionaryColumn>(0)[0], "qa");
+  EXPECT_EQ(sorted.values<frame::DictionaryColumn>(0).dictionary,
+            shared.dictionary);
+}
+
+TEST(MyClassTest, null_values) {
+  frame::ValidityBitmap bits(70);
+  bits.set(3, false);
+  bits.set(68, false);
+  frame::ValidityBitmap tail(5, false);
+  tail.set(1, true);
+  bits.append(tail);
+  EXPECT_EQ(bits.size(), 75u);
+  EXPECT_EQ(bits.null_count(), 6u);
+  EXPECT_TRUE(bits.valid(71));
+  EXPECT_FALSE(bits.slice(60, 10).valid(8));
+  std::vector<size_t> valid;
+  bits.for_each_valid(66, 75, [&](size_t i) { valid.push_back(i); });
+  EXPECT_EQ(valid, std::vector<size_t>({66, 67, 69, 71}));
+
+  // empty csv fields are NULL
+  auto path = std::filesystem::temp_directory_path() / "null_values.csv";
+  {
+    std::ofstream csv(path);
+    csv << "x,y\n1,5\n,7\n3,\n2,4\n";
+  }
+  DataFrame read;
+  read.read_csv(path.string());
+  std::filesystem::remove(path);
+  ASSERT_EQ(read.num_rows(), 4u);
+  EXPECT_FALSE(read.get_column(0).is_valid(1));
+  EXPECT_TRUE(read.get_column(0).is_valid(2));
+  EXPECT_FALSE(read.get_column(1).is_valid(2));
+  // and to_csv writes NULLs back as empty fields
+  read.to_csv(path.string());
+  DataFrame round_trip;
+  round_trip.read_csv(path.string());
+  std::filesystem::remove(path);
+  ASSERT_EQ(round_trip.num_rows(), 4u);
+  EXPECT_FALSE(round_trip.get_column(0).is_valid(1));
+  EXPECT_FALSE(round_trip.get_column(1).is_valid(2));
+  EXPECT_TRUE(round_trip.get_column(1).is_valid(1));
+  EXPECT_EQ(round_trip.get_column(1)[3], 4);
+
+  DataFrame sorted = read.sort_by({{"x", true}});
+  EXPECT_EQ(sorted.get_column(0).get_std_vector(),
+            frame::ColumnVector<int>({3, 2, 1, 0}));
+  EXPECT_FALSE(sorted.get_column(0).is_valid(3));
+  sorted = read.sort_by({{"x", false, true}});
+  EXPECT_EQ(sorted.get_column(0).get_std_vector(),
+            frame::ColumnVector<int>({0, 1, 2, 3}));
+  EXPECT_FALSE(sorted.get_column(0).is_valid(0));
+
+  // NULL keys join with nothing, a NULL 0 must not match a real 0
+  std::vector<int> x, y, xr, yr;
+  for (int r = 0; r < 300; ++r) {
+    x.push_back((r * 37) % 101);
+    y.push_back((r * 53) % 97);
+  }
+  for (int r = 0; r < 200; ++r) {
+    xr.push_back((r * 29) % 103);
+    yr.push_back((r * 31) % 89);
+  }
+  auto nulls_every = [](size_t n, size_t step) {
+    frame::ValidityBitmap validity(n);
+    for (size_t i = 0; i < n; i += step) {
+      validity.set(i, false);
+    }
+    return std::make_shared<const frame::ValidityBitmap>(std::move(validity));
+  };
+  DataFrame T = make_xy(x, y);
+  DataFrame Tr = make_xy(xr, yr);
+  T.set_validity("x", nulls_every(x.size(), 7));
+  Tr.set_validity("y", nulls_every(xr.size(), 5));
+  std::vector<Predicate> preds = {{"op1", kLess, "x", "x"},
+                                  {"op2", kGreater, "y", "y"}};
+  std::vector<std::pair<int, int>> expected;
+  for (int l = 0; l < 300; ++l) {
+    for (int r = 0; r < 200; ++r) {
+      if (l % 7 != 0 && r % 5 != 0 && x[l] < xr[r] && y[l] > yr[r]) {
+        expected.emplace_back(l, r);
+      }
+    }
+  }
+  EXPECT_EQ(sorted_pairs(LoopJoin(T, Tr, preds)), expected);
+  EXPECT_EQ(sorted_pairs(IEJoin(T, Tr, preds)), expected);
+  EXPECT_EQ(sorted_pairs(ScalableIEJoin(T, Tr, preds)), expected);
+
+  frame::TypedDataframe typed(4);
+  typed.insert("name", std::vector<std::string>{"a", "b", "", "b"},
+               nulls_every(4, 2));
+  Predicate eq = {"op1", kEqual, "name", "name"};
+  std::vector<std::pair<int, int>> matches = {{1, 1}, {1, 3}, {3, 1}, {3, 3}};
+  EXPECT_EQ(sorted_pairs(TypedEqualJoin(typed, typed, eq)), matches);
+}
+
+TEST(MyClassTest, csv_reader) {
+  std::string text(100, 'a');
+  text[37] = ';';
+  text[70] = '\n';
+  EXPECT_EQ(frame::find_either(text.data(), text.data() + text.size(), ';',
+                               '\n') - text.data(), 37);
+  EXPECT_EQ(frame::find_either(text.data() + 38, text.data() + text.size(),
+                               ';', '\n') - text.data(), 70);
+  EXPECT_EQ(frame::find_either(text.data() + 71, text.data() + text.size(),
+                               ';', '\n') - text.data(), 100);
+
+  // same values as the stream based parse_cell
+  for (std::string field : {"42", "-7", "+3", "2.5", "-0.75", ".5", "12.",
+                            "1e3", "2E-2", "Jones", " x y", "-", "1e", "inf"}) {
+    std::vector<int> expected;
+    DataFrame::parse_cell(field, expected);
+    int value = -1;
+    frame::parse_field(field.data(), field.data() + field.size(), value);
+    EXPECT_EQ(value, expected[0]) << field;
+  }
+
+  auto path = std::filesystem::temp_directory_path() / "csv_reader.csv";
+  {
+    std::ofstream csv(path);
+    csv << "id,name,salary\r\n1,Jones,100\r\n2,Brown\r\n3,Smith,2.5e2\n";
+  }
+  DataFrame read;
+  read.read_csv(path.string());
+  std::filesystem::remove(path);
+  ASSERT_EQ(read.num_rows(), 2u);
+  EXPECT_EQ(read.col_index("salary"), 2u);
+  EXPECT_EQ(read.get_column(1).get_std_vector(),
+            frame::ColumnVector<int>({5, 5}));
+  EXPECT_EQ(read.get_column(2).get_std_vector(),
+            frame::ColumnVector<int>({100, 250}));
+}
+
+TEST(MyClassTest, csv_projection) {
+  auto path = std::filesystem::temp_directory_path() / "csv_projection.csv";
+  {
+    std::ofstream csv(path);
+    csv << "id,name,dept,salary,tax\n1,Jones,4,100,10\n2,Brown,3,2.5,x\n"
+        << "3,Smith,3,300,30\n4,Lee,2,3000000000,40\n";
+  }
+  DataFrame read;
+  frame::CsvOptions options;
+  options.columns = {"salary", "tax"};
+  options.types = {{"salary", ArrowType::INT32}};
+  read.read_csv(path.string(), options);
+  ASSERT_EQ(read.num_cols(), 2u);
+  ASSERT_EQ(read.num_rows(), 4u);
+  EXPECT_EQ(read.col_index("tax"), 1u);
+  // 2.5 is no INT32 nor is 3000000000, x is text and stands for its length
+  EXPECT_FALSE(read.get_column(0).is_valid(1));
+  EXPECT_FALSE(read.get_column(0).is_valid(3));
+  EXPECT_EQ(read.get_column(0).get_std_vector(),
+            frame::ColumnVector<int>({100, 0, 300, 0}));
+  EXPECT_TRUE(read.get_column(1).is_valid(1));
+  EXPECT_EQ(read.get_column(1).get_std_vector(),
+            frame::ColumnVector<int>({10, 1, 30, 40}));
+
+  frame::TypedDataframe T;
+  options.columns = {"name", "salary"};
+  options.types = {{"salary", ArrowType::DOUBLE}};
+  T.read_csv(path.string(), options);
+  ASSERT_EQ(T.num_cols(), 2u);
+  EXPECT_EQ(T.schema().fields[0].dataType, ArrowType::STRING);
+  EXPECT_EQ(T.schema().fields[1].dataType, ArrowType::DOUBLE);
+  auto salaries = T.values<frame::ColumnVector<double>>(1);
+  EXPECT_EQ(salaries, frame::ColumnVector<double>({100, 2.5, 300, 3e9}));
+
+  options.columns = {"bonus"};
+  EXPECT_THROW(read.read_csv(path.string(), options), std::runtime_error);
+  std::filesystem::remove(path);
+}
+
+TEST(MyClassTest, parallel_csv_reader) {
+  // quoted fields hold delimiters, doubled quotes and line breaks
+  std::string text;
+  std::vector<size_t> row_starts;
+  for (int r = 0; r < 60000; ++r) {
+    row_starts.push_back(text.size());
+    if (r % 3 == 0) {
+      text += std::to_string(r) + ",\"Smith, J\n \"\"Jr\"\"\"," +
+              std::to_string(3 * r) + "\n";
+    } else {
+      text += std::to_string(r) + ",Jones," + std::to_string(3 * r) + "\n";
+    }
+  }
+  const char *begin = text.data();
+  const char *end = begin + text.size();
+  for (size_t parts : {1, 3, 16, 257}) {
+    for (const char *bound : frame::split_rows(begin, end, parts)) {
+      EXPECT_TRUE(bound == end ||
+                  std::binary_search(row_starts.begin(), row_starts.end(),
+                                     size_t(bound - begin)));
+    }
+  }
+  std::vector<std::string_view> fields;
+  frame::split_csv_row(begin, end, ',', fields);
+  ASSERT_EQ(fields.size(), 3u);
+  EXPECT_EQ(frame::unquote(fields[1]), "Smith, J\n \"Jr\"");
+
+  auto path = std::filesystem::temp_directory_path() / "parallel_csv.csv";
+  {
+    std::ofstream csv(path);
+    csv << "id,name,amount\n" << text;
+  }
+  ScopedWorkers workers(3);
+  DataFrame read;
+  read.read_csv(path.string());
+  std::filesystem::remove(path);
+  ASSERT_EQ(read.num_rows(), 60000u);
+  const auto &ids = read.get_column(0).get_std_vector();
+  const auto &amounts = read.get_column(2).get_std_vector();
+  for (int r = 0; r < 60000; ++r) {
+    ASSERT_EQ(ids[r], r);
+    ASSERT_EQ(amounts[r], 3 * r);
+  }
+}
+
+TEST(MyClassTest, columnar_file) {
+  std::vector<int> x, y;
+  for (int r = 0; r < 1000; ++r) {
+    x.push_back((r * 37) % 1009);
+    y.push_back((r * 53) % 997);
+  }
+  DataFrame T = make_xy(x, y);
+  frame::ValidityBitmap nulls(x.size());
+  nulls.set(3, false);
+  nulls.set(700, false);
+  T.set_validity("y", std::make_shared<const frame::ValidityBitmap>(nulls));
+
+  auto path = std::filesystem::temp_directory_path() / "columnar_file.col";
+  frame::write_columnar(T, path.string());
+  std::vector<Predicate> preds = {{"op1", kLess, "x", "x"},
+                                  {"op2", kGreater, "y", "y"}};
+  {
+    DataFrameView mapped = frame::open_columnar<int>(path.string(), true);
+    ASSERT_EQ(mapped.num_rows(), 1000u);
+    EXPECT_EQ(mapped.get_column_str(), T.get_column_str());
+    // the values stay in the mapping
+    const auto &ys = mapped.get_column(mapped.col_index("y"));
+    EXPECT_NE(ys.get_buffer(), T.get_column(T.col_index("y")).get_buffer());
+    EXPECT_EQ(ys.to_vector(), y);
+    EXPECT_FALSE(ys.is_valid(700));
+    EXPECT_EQ(ys.get_validity()->null_count(), 2u);
+    EXPECT_EQ(sorted_pairs(IEJoin(mapped, mapped, preds)),
+              sorted_pairs(IEJoin(T, T, preds)));
+  }
+
+  // a corrupt value fails the checksum, a foreign file the header
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(1000);
+    file.put('\x7f');
+  }
+  EXPECT_NO_THROW(frame::open_columnar<int>(path.string()));
+  EXPECT_THROW(frame::open_columnar<int>(path.string(), true),
+               std::runtime_error);
+  EXPECT_THROW(frame::open_columnar<double>(path.string()),
+               std::invalid_argument);
+  {
+    std::ofstream file(path, std::ios::trunc);
+    file << "id,name\n1,Jones\n";
+  }
+  EXPECT_THROW(frame::open_columnar<int>(path.string()), std::runtime_error);
+  std::filesystem::remove(path);
+}
+
+TEST(MyClassTest, columnar_row_groups) {
+  // x grows with the row, so the zone maps of far apart row groups prune
+  std::vector<int> x, y, xr, yr;
+  for (int r = 0; r < 2000; ++r) {
+    x.push_back(r + (r * 37) % 50);
+    y.push_back((r * 53) % 997);
+  }
+  for (int r = 0; r < 1500; ++r) {
+    xr.push_back(r / 3 + (r * 29) % 40);
+    yr.push_back((r * 31) % 89);
+  }
+  DataFrame T = make_xy(x, y);
+  DataFrame Tr = make_xy(xr, yr);
+  frame::ValidityBitmap nulls(xr.size());
+  for (size_t i = 300; i < 400; ++i) {
+    nulls.set(i, false);
+  }
+  Tr.set_validity("x", std::make_shared<const frame::ValidityBitmap>(nulls));
+
+  auto left_path = std::filesystem::temp_directory_path() / "row_groups_l.col";
+  auto right_path = std::filesystem::temp_directory_path() / "row_groups_r.col";
+  frame::ColumnarOptions options;
+  options.row_group_rows = 100;
+  frame::write_columnar(T, left_path.string(), options);
+  frame::write_columnar(Tr, right_path.string(), options);
+  frame::ColumnarFile<int> left(left_path.string(), true);
+  frame::ColumnarFile<int> right(right_path.string(), true);
+  ASSERT_EQ(left.num_row_groups(), 20u);
+  ASSERT_EQ(right.num_row_groups(), 15u);
+  EXPECT_EQ(right.zone(3, right.col_index("x")).null_count, 100u);
+  EXPECT_EQ(left.zone(2, left.col_index("x")).min, 200);
+
+  std::vector<Predicate> preds = {{"op1", kGreater, "x", "x"},
+                                  {"op2", kLess, "y", "y"}};
+  auto pairs = ZonePrunedPairs(left, right, preds);
+  EXPECT_LT(pairs.size(), 20u * 14u);
+  for (const auto &[l, r] : pairs) {
+    EXPECT_NE(r, 3);
+  }
+  auto expected = sorted_pairs(IEJoin(T, Tr, preds));
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(sorted_pairs(ScalableIEJoin(left, right, preds)), expected);
+  EXPECT_EQ(sorted_pairs(ScalableIEJoin(T, Tr, preds)), expected);
+  std::filesystem::remove(left_path);
+  std::filesystem::remove(right_path);
+}
+
+TEST(MyClassTest, batch_reader) {
+  std::vector<int> x, y, xr, yr;
+  auto path = std::filesystem::temp_directory_path() / "batch_reader.csv";
+  {
+    std::ofstream csv(path);
+    csv << "id,x,y\n";
+    for (int r = 0; r < 5000; ++r) {
+      x.push_back((r * 37) % 1009);
+      y.push_back((r * 53) % 997);
+      csv << r << "," << x.back() << "," << y.back() << "\n";
+    }
+  }
+  for (int r = 0; r < 300; ++r) {
+    xr.push_back((r * 29) % 1013);
+    yr.push_back((r * 31) % 991);
+  }
+  DataFrame T = make_xy(x, y);
+  DataFrame Tr = make_xy(xr, yr);
+  std::vector<Predicate> preds = {{"op1", kLess, "x", "x"},
+                                  {"op2", kGreater, "y", "y"}};
+  auto expected = sorted_pairs(IEJoin(T, Tr, preds));
+
+  frame::CsvBatchReader<int> csv(path.string(), 700);
+  EXPECT_EQ(csv.get_column_str(), std::vector<std::string>({"id", "x", "y"}));
+  std::vector<std::pair<int, int>> actual;
+  JoinSink collect = [&](const std::vector<std::pair<int, int>> &pairs) {
+    actual.insert(actual.end(), pairs.begin(), pairs.end());
+  };
+  StreamIEJoin(csv, Tr, preds, collect);
+  EXPECT_EQ(sorted_pairs(actual), expected);
+
+  // the probe side of HashJoin, ids 4000.. of the file are in the table
+  DataFrame ids = DataFrame::create_empty_dataframe(2000);
+  std::vector<int> shifted(2000);
+  std::iota(shifted.begin(), shifted.end(), 4000);
+  ids.insert("id", shifted);
+  actual.clear();
+  frame::CsvBatchReader<int> probe(path.string(), 700,
+                                   frame::CsvOptions{',', {"id"}, {}});
+  StreamHashJoin(ids, probe, collect);
+  EXPECT_EQ(actual.size(), 1000u);
+  EXPECT_EQ(sorted_pairs(actual).front(), std::make_pair(4000, 4000));
+
+  auto columnar_path = path;
+  columnar_path.replace_extension(".col");
+  frame::write_columnar(T, columnar_path.string());
+  frame::ColumnarBatchReader<int> columnar(columnar_path.string(), 512);
+  DataFrameView batch;
+  size_t batches = 0;
+  while (columnar.next(batch)) {
+    EXPECT_EQ(columnar.batch_offset(), batches * 512);
+    EXPECT_LE(batch.num_rows(), 512u);
+    batches++;
+  }
+  EXPECT_EQ(batches, 10u);
+  actual.clear();
+  frame::ColumnarBatchReader<int> outer(columnar_path.string(), 512);
+  StreamIEJoin(outer, Tr, preds, collect);
+  EXPECT_EQ(sorted_pairs(actual), expected);
+  std::filesystem::remove(path);
+  std::filesystem::remove(columnar_path);
+
+  // rows with the wrong number of fields are skipped, a tail of them too
+  {
+    std::ofstream csv(path);
+    csv << "id,x\n1,2\n3\n4,5\n";
+    for (int r = 0; r < 5000; ++r) {
+      csv << r << "\n";
+    }
+  }
+  frame::CsvBatchReader<int> malformed(path.string(), 1);
+  std::vector<int> read_ids;
+  while (malformed.next(batch)) {
+    ASSERT_EQ(batch.num_rows(), 1u);
+    read_ids.push_back(batch.get_column(0)[0]);
+  }
+  EXPECT_EQ(read_ids, std::vector<int>({1, 4}));
+  std::filesystem::remove(path);
+}
+
+// the file to_csv wrote before it formatted with to_chars: every value
+// through an ostream with default flags
+template <typename Frame>
+std::string streamed_csv(const Frame &frame, char delimiter) {
+  std::ostringstream out;
+  const auto &names = frame.get_column_str();
+  for (size_t c = 0; c < names.size(); ++c) {
+    out << names[c] << (c + 1 < names.size() ? delimiter : '\n');
+  }
+  for (size_t i = 0; i < frame.num_rows(); ++i) {
+    for (size_t c = 0; c < names.size(); ++c) {
+      out << frame.get_column(c)[i] << (c + 1 < names.size() ? delimiter : '\n');
+    }
+  }
+  return out.str();
+}
+
+std::string file_text(const std::filesystem::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+TEST(MyClassTest, to_csv) {
+  auto path = std::filesystem::temp_directory_path() / "to_csv.csv";
+  std::vector<int> x, y;
+  for (int r = 0; r < 40000; ++r) {
+    x.push_back((r * 7919) % 100003 - 50000);
+    y.push_back(r % 3 == 0 ? std::numeric_limits<int>::min() : r);
+  }
+  DataFrame T = make_xy(x, y);
+  ScopedWorkers workers(3);
+  T.to_csv(path.string(), ';');
+  EXPECT_EQ(file_text(path), streamed_csv(T, ';'));
+
+  frame::Dataframe<double> D = frame::Dataframe<double>::create_empty_dataframe(8);
+  D.insert("v", std::vector<double>{0.0, -0.0, 1.0 / 3, 123456789.0, 1e-7,
+                                    -2.5e300, 100000.0, 1e6});
+  D.insert("w", std::vector<double>{0.1, 1e5, 999999.5, 12.5, -7, 3e-5,
+                                    std::numeric_limits<double>::infinity(),
+                                    123.456});
+  D.to_csv(path.string());
+  EXPECT_EQ(file_text(path), streamed_csv(D, ','));
+  std::filesystem::remove(path);
+}
+
+TEST(MyClassTest, result_file) {
+  auto path = std::filesystem::temp_directory_path() / "result_file.bin";
+  std::vector<int> x, y, xr, yr;
+  for (int r = 0; r < 3000; ++r) {
+    x.push_back((r * 37) % 1009);
+    y.push_back((r * 53) % 997);
+  }
+  for (int r = 0; r < 300; ++r) {
+    xr.push_back((r * 29) % 1013);
+    yr.push_back((r * 31) % 991);
+  }
+  DataFrame T = make_xy(x, y);
+  DataFrame Tr = make_xy(xr, yr);
+  std::vector<Predicate> preds = {{"op1", kLess, "x", "x"},
+                                  {"op2", kGreater, "y", "y"}};
+  auto expected = sorted_pairs(IEJoin(T, Tr, preds));
+  ASSERT_GT(expected.size(), size_t(1) << 17);
+
+  size_t raw_bytes = 0;
+  for (bool delta_varint : {false, true}) {
+    {
+      ResultWriter writer(path.string(), ResultFileOptions{delta_varint});
+      writer.write(std::vector<std::pair<int, int>>{{-5, 7}, {3, -2}});
+      writer.write(IEJoinRanges(T, Tr, preds));
+      writer.close();
+      EXPECT_EQ(writer.pairs(), expected.size() + 2);
+      if (!delta_varint) {
+        raw_bytes = writer.bytes();
+      } else {
+        EXPECT_LT(writer.bytes(), raw_bytes);
+      }
+    }
+    ResultReader reader(path.string());
+    std::vector<std::pair<int, int>> batch;
+    ASSERT_TRUE(reader.next(batch));
+    EXPECT_EQ(batch, (std::vector<std::pair<int, int>>{{-5, 7}, {3, -2}}));
+    std::vector<std::pair<int, int>> actual;
+    while (reader.next(batch)) {
+      EXPECT_LE(batch.size(), size_t(1) << 16);
+      actual.insert(actual.end(), batch.begin(), batch.end());
+    }
+    EXPECT_EQ(sorted_pairs(actual), expected);
+  }
+
+  // written from inside the join loop, then cut short
+  auto csv_path = path;
+  csv_path.replace_extension(".csv");
+  T.to_csv(csv_path.string());
+  {
+    ResultWriter writer(path.string());
+    frame::CsvBatchReader<int> left(csv_path.string(), 700);
+    StreamIEJoin(left, Tr, preds, writer.sink());
+    writer.close();
+  }
+  EXPECT_EQ(sorted_pairs(ResultReader(path.string()).read_all()), expected);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  EXPECT_THROW(ResultReader(path.string()).read_all(), std::runtime_error);
+  {
+    // a corrupt payload size past the end of the file
+    std::ofstream out(path, std::ios::binary | std::ios::in);
+    out.seekp(sizeof(result::ResultFileHeader) + 8);
+    uint64_t bytes = uint64_t(1) << 60;
+    out.write(reinterpret_cast<const char *>(&bytes), sizeof(bytes));
+  }
+  EXPECT_THROW(ResultReader(path.string()).read_all(), std::runtime_error);
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::in);
+    out << "NOTPAIRS";
+  }
+  EXPECT_THROW(ResultReader(path.string()), std::runtime_error);
+  std::filesystem::remove(path);
+  std::filesystem::remove(csv_path);
+}
+
+TEST(MyClassTest, arrow_c_data) {
+  std::vector<int> x, y;
+  for (int r = 0; r < 200; ++r) {
+    x.push_back(r * 3);
+    y.push_back(100 - r);
+  }
+  DataFrame T = make_xy(x, y);
+  frame::ValidityBitmap nulls(200);
+  nulls.set(5, false);
+  nulls.set(130, false);
+  T.set_validity("y", std::make_shared<const frame::ValidityBitmap>(nulls));
+  const int *x_values = DataFrameView(T).get_column(T.col_index("x")).data();
+
+  ArrowArray array;
+  ArrowSchema schema;
+  frame::export_arrow(DataFrameView(T), &array, &schema);
+  EXPECT_STREQ(schema.format, "+s");
+  ASSERT_EQ(schema.n_children, 3);
+  EXPECT_STREQ(schema.children[1]->name, "x");
+  EXPECT_STREQ(schema.children[1]->format, "i");
+  EXPECT_EQ(schema.children[2]->flags, ARROW_FLAG_NULLABLE);
+  EXPECT_EQ(array.length, 200);
+  EXPECT_EQ(array.children[2]->null_count, 2);
+  EXPECT_EQ(array.children[1]->buffers[1], x_values);
+
+  DataFrameView imported = frame::import_arrow<int>(&array, &schema);
+  EXPECT_EQ(array.release, nullptr);
+  EXPECT_EQ(schema.release, nullptr);
+  T = DataFrame();
+  ASSERT_EQ(imported.num_rows(), 200u);
+  EXPECT_EQ(imported.get_column_str(), std::vector<std::string>({"row_index", "x", "y"}));
+  EXPECT_EQ(imported.get_column(1).data(), x_values);
+  EXPECT_EQ(imported.get_column(1).to_vector(), x);
+  EXPECT_FALSE(imported.get_column(2).is_valid(130));
+  EXPECT_TRUE(imported.get_column(2).is_valid(131));
+  EXPECT_EQ(imported.get_column(2)[199], -99);
+
+  // a child with an offset and a byte bitmap, as other producers make
+  std::vector<int64_t> values = {7, 8, 9, 10};
+  uint8_t bits = 0b1011;
+  const void *buffers[2] = {&bits, values.data()};
+  ArrowArray column{3, 1, 1, 2, 0, buffers, nullptr, nullptr, nullptr, nullptr};
+  ArrowSchema field{"l", "v", nullptr, ARROW_FLAG_NULLABLE, 0, nullptr,
+                    nullptr, nullptr, nullptr};
+  auto span = frame::import_arrow_column<int64_t>(column, field, nullptr);
+  EXPECT_EQ(span.to_vector(), std::vector<int64_t>({8, 9, 10}));
+  EXPECT_TRUE(span.is_valid(0));
+  EXPECT_FALSE(span.is_valid(1));
+  EXPECT_TRUE(span.is_valid(2));
+  EXPECT_THROW(frame::import_arrow_column<int>(column, field, nullptr),
+               std::invalid_argument);
+
+  std::vector<std::pair<int, int>> pairs = {{1, 2}, {3, 4}, {5, 6}};
+  frame::export_arrow(pairs, &array, &schema);
+  auto result = frame::import_arrow<int32_t>(&array, &schema);
+  EXPECT_EQ(result.get_column_str(), std::vector<std::string>({"left", "right"}));
+  EXPECT_EQ(result.get_column(0).to_vector(), std::vector<int>({1, 3, 5}));
+  EXPECT_EQ(result.get_column(1).to_vector(), std::vector<int>({2, 4, 6}));
+}
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);